@@ -1,3 +1,6 @@
+#ifdef _WIN32
+#  include <windows.h>
+#endif
 #include <stdlib.h>
 #include <GL/glew.h>
 #ifdef __APPLE__
@@ -6,8 +9,22 @@
 #  include <GL/glut.h>
 #endif
 #include <math.h>
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include "util.h"
+#include "shader.h"
+
+#define STREAM_SLOTS 8              /* regions of the persistently mapped unpack buffer */
+#define STREAM_DEFAULT_DECODERS 2   /* set by -decoders */
+#define STREAM_MAX_DECODERS 16
+#define STREAM_DEFAULT_SECONDS 5.0  /* set by -stream */
+#define STREAM_BASELINE_FRAMES 120  /* frames timed before streaming starts */
+
+static const char *g_texture_files[2] = { "hello1.tga", "hello2.tga" };
 
 /*
  * Global data used by our render callback:
@@ -16,7 +33,7 @@
 static struct {
     GLuint vertex_buffer, element_buffer;
     GLuint textures[2];
-    GLuint vertex_shader, fragment_shader, program;
+    GLuint program;
     
     struct {
         GLint fade_factor;
@@ -45,39 +62,47 @@ static GLuint make_buffer(
     return buffer;
 }
 
-static GLuint make_shader(GLenum type, const char *filename)
+static GLuint make_texture(const char *filename)
 {
-    GLint length;
-    GLchar *source = file_contents(filename, &length);
-    GLuint shader;
-    GLint shader_ok;
-
-    if (!source)
-        return 0;
+    struct tga_file tga;
+    GLuint texture, unpack_buffer = 0;
+    size_t pixels_size;
+    void *pixels;
+    int ok;
 
-    shader = glCreateShader(type);
-    glShaderSource(shader, 1, (const GLchar**)&source, &length);
-    free(source);
-    glCompileShader(shader);
-
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_ok);
-    if (!shader_ok) {
-        fprintf(stderr, "Failed to compile %s:\n", filename);
-        //show_info_log(shader, glGetShaderiv, glGetShaderInfoLog);
-        glDeleteShader(shader);
+    if (!open_tga(filename, &tga))
         return 0;
+    pixels_size = (size_t)tga.width * tga.height * 4;
+
+    /*
+     * Decode straight into a pixel unpack buffer, so glTexImage2D can copy
+     * from it without the CPU waiting, and as BGRA 8_8_8_8_REV, the layout
+     * drivers keep RGBA8 in, so the copy needs no swizzle.
+     */
+    if (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object) {
+        glGenBuffers(1, &unpack_buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack_buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, pixels_size, NULL, GL_STREAM_DRAW);
+        pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    } else
+        pixels = malloc(pixels_size);
+
+    ok = pixels && decode_tga_bgra(&tga, pixels);
+    close_tga(&tga);
+    if (unpack_buffer) {
+        if (pixels && !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+            ok = 0;
+        pixels = NULL;  /* glTexImage2D reads from offset 0 of the buffer */
     }
-    return shader;
-}
-
-static GLuint make_texture(const char *filename)
-{
-    int width, height;
-    void *pixels = read_tga(filename, &width, &height);
-    GLuint texture;
-
-    if (!pixels)
+    if (!ok) {
+        fprintf(stderr, "Unable to decode %s into a texture\n", filename);
+        if (unpack_buffer) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &unpack_buffer);
+        }
+        free(pixels);
         return 0;
+    }
 
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
@@ -87,52 +112,20 @@ static GLuint make_texture(const char *filename)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
     glTexImage2D(
         GL_TEXTURE_2D, 0,           /* target, level */
-        GL_RGB8,                    /* internal format */
-        width, height, 0,           /* width, height, border */
-        GL_BGR, GL_UNSIGNED_BYTE,   /* external format, type */
-        pixels                      /* pixels */
+        GL_RGBA8,                   /* internal format */
+        tga.width, tga.height, 0,   /* width, height, border */
+        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, /* external format, type */
+        pixels                      /* pixels, or the unpack buffer offset */
     );
-    free(pixels);
+    if (unpack_buffer) {
+        /* the buffer's storage lives on until the copy out of it is done */
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &unpack_buffer);
+    } else
+        free(pixels);
     return texture;
 }
 
-static void show_info_log(
-    GLuint object,
-    PFNGLGETSHADERIVPROC glGet__iv,
-    PFNGLGETSHADERINFOLOGPROC glGet__InfoLog
-)
-{
-    GLint log_length;
-    char *log;
-
-    glGet__iv(object, GL_INFO_LOG_LENGTH, &log_length);
-    log = malloc(log_length);
-    glGet__InfoLog(object, log_length, NULL, log);
-    fprintf(stderr, "%s", log);
-    free(log);
-}
-
-
-static GLuint make_program(GLuint vertex_shader, GLuint fragment_shader)
-{
-    GLint program_ok;
-
-    GLuint program = glCreateProgram();
-
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
-
-    glGetProgramiv(program, GL_LINK_STATUS, &program_ok);
-    if (!program_ok) {
-        fprintf(stderr, "Failed to link shader program:\n");
-        //show_info_log(program, glGetProgramiv, glGetProgramInfoLog);
-        glDeleteProgram(program);
-        return 0;
-    }
-    return program;
-}
-
 /*
  * Data used to seed our vertex array and element array buffers:
  */
@@ -160,27 +153,17 @@ static int make_resources(void)
         sizeof(g_element_buffer_data)
     );
 
-    g_resources.textures[0] = make_texture("hello1.tga");
-    g_resources.textures[1] = make_texture("hello2.tga");
+    g_resources.textures[0] = make_texture(g_texture_files[0]);
+    g_resources.textures[1] = make_texture(g_texture_files[1]);
 
     if (g_resources.textures[0] == 0 || g_resources.textures[1] == 0)
         return 0;
 
-    g_resources.vertex_shader = make_shader(
-        GL_VERTEX_SHADER,
-        "hello-gl.v.glsl"
-    );
-    if (g_resources.vertex_shader == 0)
-        return 0;
-
-    g_resources.fragment_shader = make_shader(
-        GL_FRAGMENT_SHADER,
-        "hello-gl.f.glsl"
+    g_resources.program = make_program_files(
+        "hello-gl.v.glsl",
+        "hello-gl.f.glsl",
+        NULL
     );
-    if (g_resources.fragment_shader == 0)
-        return 0;
-
-    g_resources.program = make_program(g_resources.vertex_shader, g_resources.fragment_shader);
     if (g_resources.program == 0)
         return 0;
 
@@ -197,6 +180,322 @@ static int make_resources(void)
     return 1;
 }
 
+/*
+ * Texture streaming (-stream): decoder threads decode the TGAs over and
+ * over into the slots of a persistently mapped pixel unpack buffer, and
+ * the render thread copies each finished slot into its texture with
+ * glTexSubImage2D before drawing. A fence after that draw hands the slot
+ * back, and is also when the image counts as first used. Slot states
+ * only change under the lock. Windows builds have no decoder threads
+ * and decode each request on the render thread instead.
+ */
+enum stream_slot_state {
+    SLOT_FREE,
+    SLOT_REQUESTED,     /* waiting for a decoder thread */
+    SLOT_DECODING,
+    SLOT_READY,         /* decoded, waiting for glTexSubImage2D */
+    SLOT_IN_FLIGHT      /* uploaded; fenced after the draw that samples it */
+};
+
+struct stream_slot {
+    enum stream_slot_state state;
+    int texture;        /* index into g_resources.textures and g_texture_files */
+    int ok;             /* the decode worked */
+    double requested;   /* when the render thread asked for the image */
+    GLsync fence;
+};
+
+static struct {
+    int enabled;
+    double seconds;
+    int n_decoders;
+    GLuint buffer;
+    unsigned char *map;
+    size_t slot_size;
+    GLint width, height;
+    struct stream_slot slots[STREAM_SLOTS];
+    int next_texture;
+#ifndef _WIN32
+    int quit;
+    pthread_t decoders[STREAM_MAX_DECODERS];
+    pthread_mutex_t lock;
+    pthread_cond_t requested;
+#endif
+
+    int frames;
+    double last_frame, start;
+    double baseline_frame_seconds, stream_frame_seconds;
+    int baseline_frames, stream_frames;
+    double upload_seconds;
+    size_t images, bytes;
+    double latency_sum, latency_max;
+} g_stream;
+
+static double now_seconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart/(double)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+}
+
+static void stream_lock(void)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&g_stream.lock);
+#endif
+}
+
+static void stream_unlock(void)
+{
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_stream.lock);
+#endif
+}
+
+/* decode the slot's image into its part of the mapped buffer */
+static int decode_slot(struct stream_slot *slot)
+{
+    struct tga_file tga;
+    int ok = open_tga(g_texture_files[slot->texture], &tga);
+
+    if (ok) {
+        ok = tga.width == g_stream.width && tga.height == g_stream.height
+            && decode_tga_bgra(&tga, g_stream.map + g_stream.slot_size*(slot - g_stream.slots));
+        close_tga(&tga);
+    }
+    return ok;
+}
+
+#ifndef _WIN32
+static void *stream_decoder(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_stream.lock);
+    for (;;) {
+        struct stream_slot *slot = NULL;
+        int i, ok;
+
+        while (!g_stream.quit && !slot) {
+            for (i = 0; i < STREAM_SLOTS && !slot; ++i)
+                if (g_stream.slots[i].state == SLOT_REQUESTED)
+                    slot = &g_stream.slots[i];
+            if (!slot && !g_stream.quit)
+                pthread_cond_wait(&g_stream.requested, &g_stream.lock);
+        }
+        if (!slot)
+            break;
+        slot->state = SLOT_DECODING;
+        pthread_mutex_unlock(&g_stream.lock);
+
+        ok = decode_slot(slot);
+
+        pthread_mutex_lock(&g_stream.lock);
+        slot->ok = ok;
+        slot->state = SLOT_READY;
+    }
+    pthread_mutex_unlock(&g_stream.lock);
+    return NULL;
+}
+#endif
+
+static int make_stream(void)
+{
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    int i;
+
+    if (!(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) ||
+        !(GLEW_VERSION_3_2 || GLEW_ARB_sync)) {
+        fprintf(stderr, "-stream needs persistent buffer mappings and fences (GL 4.4)\n");
+        return 0;
+    }
+
+    /* every streamed image replaces one of the textures, so they're all this size */
+    glBindTexture(GL_TEXTURE_2D, g_resources.textures[0]);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &g_stream.width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &g_stream.height);
+    g_stream.slot_size = (size_t)g_stream.width * g_stream.height * 4;
+
+    glGenBuffers(1, &g_stream.buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_stream.buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, g_stream.slot_size*STREAM_SLOTS, NULL, flags);
+    g_stream.map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                    g_stream.slot_size*STREAM_SLOTS, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!g_stream.map) {
+        fprintf(stderr, "Unable to map the streaming buffer\n");
+        return 0;
+    }
+
+#ifdef _WIN32
+    g_stream.n_decoders = 0;
+    (void)i;
+#else
+    pthread_mutex_init(&g_stream.lock, NULL);
+    pthread_cond_init(&g_stream.requested, NULL);
+    for (i = 0; i < g_stream.n_decoders; ++i)
+        if (pthread_create(&g_stream.decoders[i], NULL, stream_decoder, NULL) != 0) {
+            fprintf(stderr, "Unable to start decoder thread %d\n", i);
+            return 0;
+        }
+#endif
+    return 1;
+}
+
+/* upload whatever the decoders have finished, before the frame draws */
+static void stream_begin_frame(void)
+{
+    double now = now_seconds();
+    int ready[STREAM_SLOTS];
+    int i;
+
+    if (g_stream.frames > 0) {
+        if (g_stream.frames <= STREAM_BASELINE_FRAMES) {
+            g_stream.baseline_frame_seconds += now - g_stream.last_frame;
+            ++g_stream.baseline_frames;
+        } else if (now - g_stream.start < g_stream.seconds) {
+            g_stream.stream_frame_seconds += now - g_stream.last_frame;
+            ++g_stream.stream_frames;
+        }
+    }
+    g_stream.last_frame = now;
+    if (g_stream.frames++ == STREAM_BASELINE_FRAMES)
+        g_stream.start = now;
+
+    /* polling a fence never blocks, so the decoders wait very little */
+    stream_lock();
+    for (i = 0; i < STREAM_SLOTS; ++i) {
+        struct stream_slot *slot = &g_stream.slots[i];
+        GLenum status;
+
+        if (slot->state == SLOT_IN_FLIGHT && slot->fence) {
+            status = glClientWaitSync(slot->fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                double latency = now - slot->requested;
+
+                g_stream.latency_sum += latency;
+                if (latency > g_stream.latency_max)
+                    g_stream.latency_max = latency;
+                glDeleteSync(slot->fence);
+                slot->fence = 0;
+                slot->state = SLOT_FREE;
+            }
+        }
+
+        /* only the render thread moves a slot on from READY */
+        ready[i] = slot->state == SLOT_READY;
+        if (ready[i])
+            slot->state = SLOT_IN_FLIGHT;
+    }
+    stream_unlock();
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_stream.buffer);
+    for (i = 0; i < STREAM_SLOTS; ++i) {
+        struct stream_slot *slot = &g_stream.slots[i];
+        double start;
+
+        if (!ready[i])
+            continue;
+        if (!slot->ok) {
+            fprintf(stderr, "Unable to stream %s\n", g_texture_files[slot->texture]);
+            exit(1);
+        }
+        start = now_seconds();
+        glBindTexture(GL_TEXTURE_2D, g_resources.textures[slot->texture]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_stream.width, g_stream.height,
+                        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                        (void*)(g_stream.slot_size*i));
+        g_stream.upload_seconds += now_seconds() - start;
+        g_stream.bytes += g_stream.slot_size;
+        ++g_stream.images;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void finish_stream(void)
+{
+    double elapsed = now_seconds() - g_stream.start;
+    double baseline_ms = g_stream.baseline_frames ?
+        1000.0*g_stream.baseline_frame_seconds/g_stream.baseline_frames : 0.0;
+    double stream_ms = g_stream.stream_frames ?
+        1000.0*g_stream.stream_frame_seconds/g_stream.stream_frames : 0.0;
+    size_t images = g_stream.images ? g_stream.images : 1;
+    int i;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&g_stream.lock);
+    g_stream.quit = 1;
+    pthread_cond_broadcast(&g_stream.requested);
+    pthread_mutex_unlock(&g_stream.lock);
+    for (i = 0; i < g_stream.n_decoders; ++i)
+        pthread_join(g_stream.decoders[i], NULL);
+#else
+    (void)i;
+#endif
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g_stream.buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &g_stream.buffer);
+
+    printf("Streamed:\t%zu images, %.1f MB in %.2f s: %.1f MB/s (%d decoder threads, %d slots)\n",
+           g_stream.images, g_stream.bytes/1.0e6, elapsed, g_stream.bytes/1.0e6/elapsed,
+           g_stream.n_decoders, STREAM_SLOTS);
+    printf("Upload:\t%.3f ms of CPU per glTexSubImage2D\n",
+           1000.0*g_stream.upload_seconds/images);
+    printf("Frame time:\t%.3f ms without streaming, %.3f ms with: %.3f ms added\n",
+           baseline_ms, stream_ms, stream_ms - baseline_ms);
+    printf("Latency:\t%.2f ms mean, %.2f ms max, from request to the first draw with it done\n",
+           1000.0*g_stream.latency_sum/images, 1000.0*g_stream.latency_max);
+    exit(0);
+}
+
+/* fence this frame's uploads, keep the decoders busy, and end the run */
+static void stream_end_frame(void)
+{
+    double now = now_seconds();
+    int streaming = g_stream.frames > STREAM_BASELINE_FRAMES
+        && now - g_stream.start < g_stream.seconds;
+    int i, busy = 0;
+
+    stream_lock();
+    for (i = 0; i < STREAM_SLOTS; ++i) {
+        struct stream_slot *slot = &g_stream.slots[i];
+
+        if (slot->state == SLOT_IN_FLIGHT && !slot->fence)
+            slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (slot->state == SLOT_FREE && streaming) {
+            slot->state = SLOT_REQUESTED;
+            slot->texture = g_stream.next_texture;
+            slot->requested = now;
+            g_stream.next_texture ^= 1;
+        }
+#ifdef _WIN32
+        if (slot->state == SLOT_REQUESTED) {
+            slot->ok = decode_slot(slot);
+            slot->state = SLOT_READY;
+        }
+#endif
+        busy |= slot->state != SLOT_FREE;
+    }
+#ifndef _WIN32
+    pthread_cond_broadcast(&g_stream.requested);
+#endif
+    stream_unlock();
+
+    /* once time is up, wait for the images in the pipe before reporting */
+    if (g_stream.frames > STREAM_BASELINE_FRAMES && !streaming && !busy)
+        finish_stream();
+}
+
 /*
  * GLUT callbacks:
  */
@@ -210,6 +509,9 @@ static void update_fade_factor(void)
 
 static void render(void)
 {
+    if (g_stream.enabled)
+        stream_begin_frame();
+
     glUseProgram(g_resources.program);
 
     glUniform1f(g_resources.uniforms.fade_factor, g_resources.fade_factor);
@@ -242,6 +544,8 @@ static void render(void)
     );
 
     glDisableVertexAttribArray(g_resources.attributes.position);
+    if (g_stream.enabled)
+        stream_end_frame();
     glutSwapBuffers();
 }
 
@@ -250,7 +554,32 @@ static void render(void)
  */
 int main(int argc, char** argv)
 {
+    const char *shader_cache_dir = NULL;
+    int i;
+
     glutInit(&argc, argv);
+
+    g_stream.n_decoders = STREAM_DEFAULT_DECODERS;
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-stream") == 0) {
+            g_stream.enabled = 1;
+            g_stream.seconds = STREAM_DEFAULT_SECONDS;
+            if (i + 1 < argc && argv[i+1][0] != '-')
+                g_stream.seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-shadercache") == 0 && i + 1 < argc) {
+            shader_cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "-decoders") == 0 && i + 1 < argc) {
+            g_stream.n_decoders = atoi(argv[++i]);
+            if (g_stream.n_decoders < 1 || g_stream.n_decoders > STREAM_MAX_DECODERS) {
+                fprintf(stderr, "-decoders must be 1 to %d\n", STREAM_MAX_DECODERS);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-shadercache dir] [-stream [seconds]] [-decoders N]\n", argv[0]);
+            return 1;
+        }
+    }
+
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
     glutInitWindowSize(400, 300);
     glutCreateWindow("Hello World");
@@ -263,10 +592,16 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    shader_cache_init(shader_cache_dir);
     if (!make_resources()) {
         fprintf(stderr, "Failed to load resources\n");
         return 1;
     }
+    print_shader_stats();
+    if (g_stream.enabled && !make_stream()) {
+        fprintf(stderr, "Failed to start streaming\n");
+        return 1;
+    }
 
     glutMainLoop();
     return 0;
@@ -0,0 +1,328 @@
+#include <GL/glew.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#  include <direct.h>
+#else
+#  include <sys/stat.h>
+#endif
+#include "util.h"
+#include "shader.h"
+
+/*
+ * Shader and program building shared by hello-gl and wesbench. Linked
+ * programs can be kept as glGetProgramBinary blobs in a cache
+ * directory, keyed by a hash of everything that goes into the link and
+ * of the driver that made the blob; a blob the driver turns down is
+ * simply rebuilt from source.
+ */
+
+#define SHADER_CACHE_MAGIC 0x42504c47u /* "GLPB" */
+
+struct shader_cache_header {
+    unsigned int magic;
+    unsigned int format;            /* the driver's binaryFormat */
+    unsigned int length;            /* bytes of binary after the header */
+    unsigned int pad;
+    unsigned long long key;         /* checked again, the file name is only a hint */
+};
+
+static struct {
+    char *dir;
+    int compiled, loaded;
+    double compile_seconds, load_seconds;
+} g_shader_cache;
+
+static double seconds_now(void)
+{
+#ifdef _WIN32
+    return (double)clock()/CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+}
+
+void show_info_log(
+    GLuint object,
+    PFNGLGETSHADERIVPROC glGet__iv,
+    PFNGLGETSHADERINFOLOGPROC glGet__InfoLog
+)
+{
+    GLint log_length;
+    char *log;
+
+    glGet__iv(object, GL_INFO_LOG_LENGTH, &log_length);
+    if (log_length <= 0)
+        return;
+    log = malloc(log_length);
+    glGet__InfoLog(object, log_length, NULL, log);
+    fprintf(stderr, "%s", log);
+    free(log);
+}
+
+GLuint make_shader_source(GLenum type, const GLchar *source, const char *name)
+{
+    GLuint shader;
+    GLint shader_ok;
+
+    shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_ok);
+    if (!shader_ok) {
+        fprintf(stderr, "Failed to compile %s:\n", name);
+        show_info_log(shader, glGetShaderiv, glGetShaderInfoLog);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint make_shader(GLenum type, const char *filename)
+{
+    GLint length;
+    GLchar *source = file_contents(filename, &length);
+    GLuint shader;
+
+    if (!source)
+        return 0;
+
+    shader = make_shader_source(type, source, filename);
+    free(source);
+    return shader;
+}
+
+/* 64-bit FNV-1a, with each string's terminator hashed so "ab","c" != "a","bc" */
+static unsigned long long hash_string(unsigned long long hash, const char *s)
+{
+    if (!s)
+        s = "";
+    do {
+        hash ^= (unsigned char)*s;
+        hash *= 0x100000001b3ull;
+    } while (*s++);
+    return hash;
+}
+
+static unsigned long long program_key(const GLchar *vs_source, const GLchar *fs_source,
+                                      const char **attrib_names)
+{
+    unsigned long long key = 0xcbf29ce484222325ull;
+    int i;
+
+    key = hash_string(key, (const char *)glGetString(GL_VENDOR));
+    key = hash_string(key, (const char *)glGetString(GL_RENDERER));
+    key = hash_string(key, (const char *)glGetString(GL_VERSION));
+    key = hash_string(key, vs_source ? vs_source : "(fixed function)");
+    key = hash_string(key, fs_source ? fs_source : "(fixed function)");
+    for (i = 0; attrib_names && attrib_names[i]; ++i)
+        key = hash_string(key, attrib_names[i]);
+    return key;
+}
+
+static int shader_cache_usable(void)
+{
+    GLint formats = 0;
+
+    if (!g_shader_cache.dir || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+        return 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static void cache_path(char *path, size_t size, unsigned long long key)
+{
+    snprintf(path, size, "%s/%016llx.glpb", g_shader_cache.dir, key);
+}
+
+static GLuint load_cached_program(unsigned long long key)
+{
+    struct shader_cache_header header;
+    char path[1024];
+    GLuint program = 0;
+    GLint program_ok;
+    void *binary;
+    FILE *f;
+
+    cache_path(path, sizeof(path), key);
+    f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    if (fread(&header, sizeof(header), 1, f) == 1 &&
+        header.magic == SHADER_CACHE_MAGIC && header.key == key &&
+        (binary = malloc(header.length ? header.length : 1)) != NULL) {
+        if (fread(binary, 1, header.length, f) == header.length) {
+            program = glCreateProgram();
+            glProgramBinary(program, header.format, binary, header.length);
+            glGetProgramiv(program, GL_LINK_STATUS, &program_ok);
+            if (!program_ok) {
+                /* a driver update, most likely: rebuild and overwrite it */
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+        free(binary);
+    }
+    fclose(f);
+    return program;
+}
+
+static void store_cached_program(GLuint program, unsigned long long key)
+{
+    struct shader_cache_header header;
+    char path[1024], temp[1040];
+    GLint length = 0;
+    GLenum format;
+    void *binary;
+    FILE *f;
+
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || !(binary = malloc(length)))
+        return;
+    glGetProgramBinary(program, length, &length, &format, binary);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SHADER_CACHE_MAGIC;
+    header.format = format;
+    header.length = length;
+    header.key = key;
+
+    /* write it aside and rename, so a reader never sees half a file */
+    cache_path(path, sizeof(path), key);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    f = fopen(temp, "wb");
+    if (!f) {
+        fprintf(stderr, "Unable to write the shader cache file %s\n", temp);
+        free(binary);
+        return;
+    }
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(binary, 1, length, f) != (size_t)length) {
+        fprintf(stderr, "Unable to write the shader cache file %s\n", temp);
+        fclose(f);
+        remove(temp);
+        free(binary);
+        return;
+    }
+    fclose(f);
+    free(binary);
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(temp, path) != 0)
+        remove(temp);
+}
+
+/*
+ * Build a program from two source strings. Either can be NULL to leave
+ * that stage to the fixed-function pipeline. attrib_names, if not NULL,
+ * is a NULL terminated list bound to generic attributes 0, 1, 2, ...
+ */
+GLuint make_program_source(const GLchar *vs_source, const GLchar *fs_source,
+                           const char **attrib_names, const char *name)
+{
+    GLuint vs = 0, fs = 0, program;
+    GLint program_ok;
+    unsigned long long key = 0;
+    int cache = shader_cache_usable();
+    double start = seconds_now();
+    int i;
+
+    if (cache) {
+        key = program_key(vs_source, fs_source, attrib_names);
+        program = load_cached_program(key);
+        if (program) {
+            ++g_shader_cache.loaded;
+            g_shader_cache.load_seconds += seconds_now() - start;
+            return program;
+        }
+    }
+
+    if (vs_source && !(vs = make_shader_source(GL_VERTEX_SHADER, vs_source, name)))
+        return 0;
+    if (fs_source && !(fs = make_shader_source(GL_FRAGMENT_SHADER, fs_source, name))) {
+        glDeleteShader(vs);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    if (vs)
+        glAttachShader(program, vs);
+    if (fs)
+        glAttachShader(program, fs);
+    for (i = 0; attrib_names != NULL && attrib_names[i] != NULL; i++)
+        glBindAttribLocation(program, i, attrib_names[i]);
+    if (cache)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    /* the program keeps its shaders alive until it is deleted itself */
+    if (vs)
+        glDeleteShader(vs);
+    if (fs)
+        glDeleteShader(fs);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &program_ok);
+    if (!program_ok) {
+        fprintf(stderr, "Failed to link %s program:\n", name);
+        show_info_log(program, glGetProgramiv, glGetProgramInfoLog);
+        glDeleteProgram(program);
+        return 0;
+    }
+    ++g_shader_cache.compiled;
+    g_shader_cache.compile_seconds += seconds_now() - start;
+
+    if (cache)
+        store_cached_program(program, key);
+    return program;
+}
+
+GLuint make_program_files(const char *vs_filename, const char *fs_filename,
+                          const char **attrib_names)
+{
+    GLint length;
+    GLchar *vs_source = vs_filename ? file_contents(vs_filename, &length) : NULL;
+    GLchar *fs_source = fs_filename ? file_contents(fs_filename, &length) : NULL;
+    GLuint program = 0;
+
+    if ((!vs_filename || vs_source) && (!fs_filename || fs_source))
+        program = make_program_source(vs_source, fs_source, attrib_names,
+                                      fs_filename ? fs_filename : vs_filename);
+    free(vs_source);
+    free(fs_source);
+    return program;
+}
+
+void shader_cache_init(const char *dir)
+{
+    free(g_shader_cache.dir);
+    g_shader_cache.dir = NULL;
+    if (!dir)
+        return;
+#ifdef _WIN32
+    if (_mkdir(dir) != 0 && errno != EEXIST) {
+#else
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+#endif
+        fprintf(stderr, "Unable to create the shader cache %s, compiling every time\n", dir);
+        return;
+    }
+    g_shader_cache.dir = malloc(strlen(dir) + 1);
+    if (g_shader_cache.dir)
+        strcpy(g_shader_cache.dir, dir);
+}
+
+void print_shader_stats(void)
+{
+    printf("Shaders:\t%d programs compiled in %.3f ms, %d loaded from the cache in %.3f ms%s\n",
+           g_shader_cache.compiled, 1000.0*g_shader_cache.compile_seconds,
+           g_shader_cache.loaded, 1000.0*g_shader_cache.load_seconds,
+           g_shader_cache.dir ? (shader_cache_usable() ? "" : " (no binary formats)")
+                              : " (cache off)");
+}
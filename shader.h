@@ -0,0 +1,15 @@
+void show_info_log(
+    GLuint object,
+    PFNGLGETSHADERIVPROC glGet__iv,
+    PFNGLGETSHADERINFOLOGPROC glGet__InfoLog
+);
+GLuint make_shader_source(GLenum type, const GLchar *source, const char *name);
+GLuint make_shader(GLenum type, const char *filename);
+GLuint make_program_source(const GLchar *vs_source, const GLchar *fs_source,
+                           const char **attrib_names, const char *name);
+GLuint make_program_files(const char *vs_filename, const char *fs_filename,
+                          const char **attrib_names);
+
+/* programs are cached as binaries in dir from here on; NULL turns it off */
+void shader_cache_init(const char *dir);
+void print_shader_stats(void);
@@ -2,6 +2,20 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define TGA_X86_SIMD 1
+#else
+#  define TGA_X86_SIMD 0
+#endif
+#include "util.h"
 
 /*
  * Boring, non-OpenGL-related utility functions
@@ -29,85 +43,301 @@ void *file_contents(const char *filename, GLint *length)
     return buffer;
 }
 
-static short le_short(unsigned char *bytes)
+static int le_short(const unsigned char *bytes)
 {
-    return bytes[0] | ((char)bytes[1] << 8);
+    return bytes[0] | (bytes[1] << 8);
 }
 
-void *read_tga(const char *filename, int *width, int *height)
+/*
+ * Map a whole file read-only. Without mmap the file is read into
+ * memory instead; unmap_file undoes either.
+ */
+static const unsigned char *map_file(const char *filename, size_t *size)
 {
-    struct tga_header {
-       char  id_length;
-       char  color_map_type;
-       char  data_type_code;
-       unsigned char  color_map_origin[2];
-       unsigned char  color_map_length[2];
-       char  color_map_depth;
-       unsigned char  x_origin[2];
-       unsigned char  y_origin[2];
-       unsigned char  width[2];
-       unsigned char  height[2];
-       char  bits_per_pixel;
-       char  image_descriptor;
-    } header;
-    int i, color_map_size, pixels_size;
-    FILE *f;
-    size_t read;
-    void *pixels;
-
-    f = fopen(filename, "rb");
+#ifdef _WIN32
+    FILE *f = fopen(filename, "rb");
+    unsigned char *buffer;
 
     if (!f) {
         fprintf(stderr, "Unable to open %s for reading\n", filename);
         return NULL;
     }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer = malloc(*size ? *size : 1);
+    if (buffer)
+        *size = fread(buffer, 1, *size, f);
+    fclose(f);
+    return buffer;
+#else
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    void *map;
 
-    read = fread(&header, 1, sizeof(header), f);
-
-    if (read != sizeof(header)) {
-        fprintf(stderr, "%s has incomplete tga header\n", filename);
-        fclose(f);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s for reading\n", filename);
         return NULL;
     }
-    if (header.data_type_code != 2) {
-        fprintf(stderr, "%s is not an uncompressed RGB tga file\n", filename);
-        fclose(f);
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s is empty\n", filename);
+        close(fd);
         return NULL;
     }
-    if (header.bits_per_pixel != 24) {
-        fprintf(stderr, "%s is not a 24-bit uncompressed RGB tga file\n", filename);
-        fclose(f);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s\n", filename);
         return NULL;
     }
+    /* decoding reads it front to back, once */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    *size = st.st_size;
+    return map;
+#endif
+}
+
+static void unmap_file(const unsigned char *map, size_t size)
+{
+#ifdef _WIN32
+    free((void*)map);
+#else
+    munmap((void*)map, size);
+#endif
+}
+
+#define TGA_HEADER_SIZE 18
+
+/*
+ * Map a TGA and check its header. Uncompressed (type 2) and RLE
+ * (type 10) truecolor images with 24 or 32 bits per pixel are taken.
+ */
+int open_tga(const char *filename, struct tga_file *tga)
+{
+    const unsigned char *header;
+    size_t color_map_size, offset;
+
+    memset(tga, 0, sizeof(*tga));
+    tga->filename = filename;
+    tga->map = map_file(filename, &tga->map_size);
+    if (!tga->map)
+        return 0;
+    header = tga->map;
+
+    if (tga->map_size < TGA_HEADER_SIZE) {
+        fprintf(stderr, "%s has incomplete tga header\n", filename);
+        goto fail;
+    }
+    if (header[2] != 2 && header[2] != 10) {
+        fprintf(stderr, "%s is not an uncompressed or RLE RGB tga file\n", filename);
+        goto fail;
+    }
+    if (header[16] != 24 && header[16] != 32) {
+        fprintf(stderr, "%s is not a 24 or 32-bit RGB tga file\n", filename);
+        goto fail;
+    }
+
+    color_map_size = header[1] ? le_short(header + 5) * ((header[7] + 7)/8) : 0;
+    offset = TGA_HEADER_SIZE + header[0] + color_map_size;
+    if (offset > tga->map_size) {
+        fprintf(stderr, "%s has incomplete id string or color map\n", filename);
+        goto fail;
+    }
+
+    tga->width = le_short(header + 12);
+    tga->height = le_short(header + 14);
+    tga->bytes_per_pixel = header[16]/8;
+    tga->rle = header[2] == 10;
+    tga->top_down = (header[17] & 0x20) != 0;
+    tga->pixels = tga->map + offset;
+    tga->pixels_size = tga->map_size - offset;
+    if (tga->width == 0 || tga->height == 0) {
+        fprintf(stderr, "%s has no pixels\n", filename);
+        goto fail;
+    }
+    if (!tga->rle &&
+        tga->pixels_size < (size_t)tga->width * tga->height * tga->bytes_per_pixel) {
+        fprintf(stderr, "%s has incomplete image\n", filename);
+        goto fail;
+    }
+    return 1;
+
+fail:
+    close_tga(tga);
+    return 0;
+}
+
+void close_tga(struct tga_file *tga)
+{
+    if (tga->map)
+        unmap_file(tga->map, tga->map_size);
+    tga->map = tga->pixels = NULL;
+}
 
-    for (i = 0; i < header.id_length; ++i)
-        if (getc(f) == EOF) {
-            fprintf(stderr, "%s has incomplete id string\n", filename);
-            fclose(f);
-            return NULL;
+#if TGA_X86_SIMD
+/* 4 BGR pixels per shuffle; returns how many pixels it did */
+__attribute__((target("ssse3")))
+static size_t expand_bgr_ssse3(unsigned char *dst, const unsigned char *src, size_t count)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                          6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+
+    /* each load reads 16 bytes for the 12 it uses, so stop 2 pixels short */
+    for (; i + 6 <= count; i += 4) {
+        __m128i bgr = _mm_loadu_si128((const __m128i*)(src + 3*i));
+        __m128i bgra = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+        _mm_storeu_si128((__m128i*)(dst + 4*i), bgra);
+    }
+    return i;
+}
+#endif
+
+/* BGR to BGRA with opaque alpha */
+static void expand_bgr(unsigned char *dst, const unsigned char *src, size_t count)
+{
+    size_t i = 0;
+
+#if TGA_X86_SIMD
+    static int has_ssse3 = -1;
+
+    if (has_ssse3 < 0)
+        has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3)
+        i = expand_bgr_ssse3(dst, src, count);
+#endif
+    for (; i < count; ++i) {
+        dst[4*i + 0] = src[3*i + 0];
+        dst[4*i + 1] = src[3*i + 1];
+        dst[4*i + 2] = src[3*i + 2];
+        dst[4*i + 3] = 0xff;
+    }
+}
+
+/* count copies of one BGRA pixel, for RLE runs */
+static void fill_pixels(unsigned char *dst, const unsigned char *pixel, size_t count)
+{
+    size_t i = 0;
+    unsigned int value;
+
+    memcpy(&value, pixel, 4);
+#ifdef __SSE2__
+    {
+        __m128i four = _mm_set1_epi32((int)value);
+
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_si128((__m128i*)(dst + 4*i), four);
+    }
+#endif
+    for (; i < count; ++i)
+        memcpy(dst + 4*i, &value, 4);
+}
+
+/*
+ * Decode into width*height BGRA pixels, bottom row first as
+ * glTexImage2D wants them. pixels can be a write-only mapped unpack
+ * buffer: every pixel is written once and nothing is read back, though
+ * a top-down file fills the rows last to first.
+ */
+int decode_tga_bgra(const struct tga_file *tga, void *pixels)
+{
+    unsigned char *out = pixels;
+    size_t bpp = tga->bytes_per_pixel, row_size = (size_t)tga->width * 4;
+    int y;
+
+    if (!tga->rle) {
+        for (y = 0; y < tga->height; ++y) {
+            const unsigned char *src = tga->pixels + (size_t)y * tga->width * bpp;
+            unsigned char *dst = out + row_size * (tga->top_down ? tga->height - 1 - y : y);
+
+            if (bpp == 4)
+                memcpy(dst, src, row_size);
+            else
+                expand_bgr(dst, src, tga->width);
         }
+        return 1;
+    } else {
+        const unsigned char *in = tga->pixels, *in_end = tga->pixels + tga->pixels_size;
+        size_t left = (size_t)tga->width * tga->height;
+        unsigned char *dst = out + row_size * (tga->top_down ? tga->height - 1 : 0);
+        int x = 0;
+
+        /* packets may run across rows: split them at row ends, so each
+           row lands straight in its bottom-up place */
+        y = 0;
+        while (left > 0) {
+            unsigned char pixel[4];
+            size_t count;
+            int run;
+
+            if (in >= in_end)
+                goto incomplete;
+            run = *in & 0x80;
+            count = (*in++ & 0x7f) + 1;
+            if (count > left)
+                count = left;
+            if (run) {
+                if ((size_t)(in_end - in) < bpp)
+                    goto incomplete;
+                pixel[0] = in[0];
+                pixel[1] = in[1];
+                pixel[2] = in[2];
+                pixel[3] = bpp == 4 ? in[3] : 0xff;
+                in += bpp;
+            } else if ((size_t)(in_end - in) < count * bpp) {
+                goto incomplete;
+            }
+            left -= count;
 
-    color_map_size = le_short(header.color_map_length) * (header.color_map_depth/8);
-    for (i = 0; i < color_map_size; ++i)
-        if (getc(f) == EOF) {
-            fprintf(stderr, "%s has incomplete color map\n", filename);
-            fclose(f);
-            return NULL;
+            while (count > 0) {
+                size_t n = (size_t)(tga->width - x);
+
+                if (n > count)
+                    n = count;
+                if (run)
+                    fill_pixels(dst + 4*(size_t)x, pixel, n);
+                else if (bpp == 4)
+                    memcpy(dst + 4*(size_t)x, in, n * 4);
+                else
+                    expand_bgr(dst + 4*(size_t)x, in, n);
+                if (!run)
+                    in += n * bpp;
+                count -= n;
+                x += (int)n;
+                if (x == tga->width && ++y < tga->height) {
+                    x = 0;
+                    dst = out + row_size * (tga->top_down ? tga->height - 1 - y : y);
+                }
+            }
         }
+        return 1;
+    }
 
-    *width = le_short(header.width); *height = le_short(header.height);
-    pixels_size = *width * *height * (header.bits_per_pixel/8);
-    pixels = malloc(pixels_size);
+incomplete:
+    fprintf(stderr, "%s has incomplete image\n", tga->filename);
+    return 0;
+}
 
-    read = fread(pixels, 1, pixels_size, f);
-    fclose(f);
+/* the whole image as malloc'd BGRA pixels */
+void *read_tga(const char *filename, int *width, int *height)
+{
+    struct tga_file tga;
+    void *pixels;
 
-    if (read != pixels_size) {
-        fprintf(stderr, "%s has incomplete image\n", filename);
-        free(pixels);
+    if (!open_tga(filename, &tga))
         return NULL;
-    }
 
+    pixels = malloc((size_t)tga.width * tga.height * 4);
+    if (!pixels) {
+        fprintf(stderr, "Out of memory reading %s\n", filename);
+    } else if (!decode_tga_bgra(&tga, pixels)) {
+        free(pixels);
+        pixels = NULL;
+    } else {
+        *width = tga.width;
+        *height = tga.height;
+    }
+    close_tga(&tga);
     return pixels;
 }
-
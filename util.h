@@ -1,3 +1,15 @@
+/* a TGA file mapped by open_tga, ready for decode_tga_bgra */
+struct tga_file {
+    const char *filename;
+    const unsigned char *map, *pixels;  /* the whole file, the first pixel packet */
+    size_t map_size, pixels_size;
+    int width, height;
+    int bytes_per_pixel;                /* 3 or 4 */
+    int rle, top_down;
+};
+
 void *file_contents(const char *filename, GLint *length);
 void *read_tga(const char *filename, int *width, int *height);
-
+int open_tga(const char *filename, struct tga_file *tga);
+int decode_tga_bgra(const struct tga_file *tga, void *pixels);
+void close_tga(struct tga_file *tga);
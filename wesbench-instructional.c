@@ -14,21 +14,40 @@
 #define SCREENSHOT_MODE 0
 
 /*
- * choose an internal texture storage format. This one could be specified by a
- * command-line argument.
+ * setting WESBENCH_HEADLESS to 1 builds in the -headless backend, which
+ * creates its context through EGL on Mesa's surfaceless platform (falling
+ * back to the default EGL display) and renders into an FBO instead of a
+ * window. Needs libEGL at link time.
  */
-#define TEXTURE_STORAGE_MODE GL_RGBA8
-/*#define TEXTURE_STORAGE_MODE GL_R3_G3_B2 */
+#if defined(_WIN32) || defined(__APPLE__)
+#define WESBENCH_HEADLESS 0
+#else
+#define WESBENCH_HEADLESS 1
+#endif
 
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#if WESBENCH_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 #include "util.h"
+#include "shader.h"
 
 void Init (void);
 void printInfo (GLFWwindow * window);
@@ -41,8 +60,93 @@ void check_gl_errors (void);
 typedef enum
   {
     DISJOINT_TRIANGLES = 0x00,
+    TRIANGLE_STRIPS = 0x01,
+    INDEXED_DISJOINT_TRIANGLES = 0x02,
+    INDEXED_TRIANGLE_STRIPS = 0x03,
   } TriangleType;
 
+typedef enum
+  {
+    SUBMIT_SINGLE_DRAW = 0x00,  /* one glDrawArrays/glDrawElements per frame */
+    SUBMIT_DRAW_LOOP = 0x01,    /* N glDrawArrays calls */
+    SUBMIT_MULTI_DRAW = 0x02,   /* one glMultiDrawArrays of N ranges */
+    SUBMIT_INSTANCED = 0x03,    /* glDrawArraysInstanced, N offset instances */
+    SUBMIT_INDIRECT = 0x04,     /* glMultiDrawArraysIndirect, N commands */
+  } SubmitMode;
+
+typedef enum
+  {
+    UPLOAD_NONE = 0x00,         /* static geometry, rotated by the modelview */
+    UPLOAD_ORPHAN = 0x01,       /* glBufferData with the new positions */
+    UPLOAD_SUBDATA = 0x02,      /* glBufferSubData into the same store */
+    UPLOAD_MAP_INVALIDATE = 0x03, /* glMapBufferRange, INVALIDATE_BUFFER */
+    UPLOAD_MAP_UNSYNCHRONIZED = 0x04, /* UNSYNCHRONIZED map of a fenced region */
+    UPLOAD_PERSISTENT = 0x05,   /* persistent coherent ring of fenced regions */
+  } UploadMode;
+
+/* how the -frag workload picks one of three equally long loops */
+typedef enum
+  {
+    BRANCH_NONE = 0x00,         /* one loop, no branch */
+    BRANCH_UNIFORM = 0x01,      /* on a uniform: every fragment agrees */
+    BRANCH_TILE = 0x02,         /* on DIVERGE_TILE_PIXELS wide columns */
+    BRANCH_PIXEL = 0x03,        /* on mod(x, 3), as hello-gl.f.glsl does */
+    BRANCH_MIX = 0x04,          /* mod(x, 3) again, but mix()ed constants, no branch */
+  } BranchMode;
+
+typedef enum
+  {
+    TEX_NEAREST = 0x00,         /* GL_NEAREST, 1 texel per sample */
+    TEX_BILINEAR = 0x01,        /* GL_LINEAR, 4 texels */
+    TEX_TRILINEAR = 0x02,       /* GL_LINEAR_MIPMAP_LINEAR, 8 texels from two levels */
+  } TexFilter;
+
+typedef enum
+  {
+    TEX_COHERENT = 0x00,        /* the mesh texcoords: the texture spans the mesh once */
+    TEX_SCALED = 0x01,          /* the same times -texscale, repeating */
+    TEX_RANDOM = 0x02,          /* each triangle moved to a random spot of the texture */
+  } TexAccess;
+
+/*
+ * Vertex encodings for the dispatch streams. Fixed-function positions
+ * can't be normalized, so POS_SHORT stores fixed-point pixel coordinates
+ * (1/positionScale px steps) and the modelview scales them back.
+ */
+typedef enum
+  {
+    POS_FLOAT = 0x00,           /* 2 x GL_FLOAT, 8 bytes */
+    POS_HALF = 0x01,            /* 2 x GL_HALF_FLOAT, 4 bytes */
+    POS_SHORT = 0x02,           /* 2 x GL_SHORT fixed point, 4 bytes */
+  } PositionFormat;
+
+typedef enum
+  {
+    COLOR_FLOAT = 0x00,         /* 3 x GL_FLOAT, 12 bytes */
+    COLOR_HALF = 0x01,          /* 4 x GL_HALF_FLOAT, 8 bytes */
+    COLOR_SHORT = 0x02,         /* 4 x normalized GL_SHORT, 8 bytes */
+    COLOR_UBYTE = 0x03,         /* Color4DUbyte, 4 bytes */
+    COLOR_INT_2_10_10_10 = 0x04, /* GL_INT_2_10_10_10_REV, 4 bytes */
+  } ColorFormat;
+
+static const char *uploadModeNames[] =
+  { "none", "orphan", "subdata", "map invalidate", "map unsynchronized", "persistent ring" };
+
+static const char *branchModeNames[] =
+  { "none", "uniform", "tile-coherent", "per-pixel mod 3", "branch-free mix" };
+
+static const char *texFilterNames[] =
+  { "nearest", "bilinear", "trilinear" };
+
+static const char *texAccessNames[] =
+  { "coherent", "scaled", "random" };
+
+static const char *submitModeNames[] =
+  { "single draw", "draw loop", "multi-draw", "instanced", "multi-draw indirect" };
+
+static const char *triangleTypeNames[] =
+  { "disjoint", "tstrip", "indexed disjoint", "indexed tstrip" };
+
 #define DEFAULT_TRIANGLE_AREA 128.0
 #define DEFAULT_TEST_DURATION_SECONDS 5.0
 #define DEFAULT_WIN_WIDTH 1024
@@ -51,16 +155,92 @@ typedef enum
 #define DEFAULT_VERTEXBUF_LIMIT 1024*1024*1024 /* 1G */
 #define DEFAULT_DUMP_FILE_NAME "wesBench-dump.txt"
 #define DEFAULT_RETAINED_MODE_ENABLED  0
+#define DEFAULT_BUFFER_USAGE GL_STATIC_DRAW /* set by -bu, only used with -retained */
 #define DEFAULT_TRIANGLE_TYPE DISJOINT_TRIANGLES;
+#define DEFAULT_INDEX_BITS 0 /* 0 picks 16 or 32 bit indices from the mesh size */
+#define POST_TRANSFORM_CACHE_SIZE 32 /* FIFO entries assumed by the reuse estimate */
+#define DEFAULT_GPU_TIMERS_ENABLED 1 /* cleared by -notimers */
+#define QUERY_RING_SIZE 8 /* frames of GL queries kept in flight */
+#define FRAME_HISTOGRAM_BUCKETS 24 /* log2 buckets of frame time, from 1us */
+#define DEFAULT_SWEEP_CI_TOLERANCE 0.02 /* set by -ci, relative 95% CI half-width */
+#define SWEEP_MIN_FRAMES 20         /* frames each sweep point runs at minimum */
+#define SWEEP_MIN_LOG2_AREA 1       /* the sweep covers 2^1 .. 2^17 pixel areas */
+#define SWEEP_MAX_LOG2_AREA 17
+#define SWEEP_LOG2_RESOLUTION 0.25  /* bisect until the bracket is this narrow */
+#define SWEEP_MAX_POINTS 32
+#define MESH_STREAM_NORMALS 0x01 /* optional base/dispatch streams to build */
+#define MESH_STREAM_TCS 0x02
+#define MAX_MESH_THREADS 64
+#define MESH_PARALLEL_MIN_ITEMS 65536 /* smaller meshes are built inline */
+#define ARENA_PAGE_BYTES (2u<<20) /* arena blocks are 2MB aligned for huge pages */
+#define ARENA_MIN_BLOCK_BYTES (16u<<20)
+#define ARENA_ALIGN 64
+#define ARENA_SPARE_LIMIT_BYTES (256u<<20) /* released blocks kept mapped for reuse */
+#define DEFAULT_LOCK_MESH_PAGES 0 /* set by -mlock */
+#define DEFAULT_MESH_CACHE_MB 1024 /* set by -cachemb, 0 disables the mesh cache */
+#define DEFAULT_TRIALS 1
+#define DEFAULT_UPLOAD_FRAMES_IN_FLIGHT 3 /* set by -inflight */
+#define MAX_UPLOAD_FRAMES_IN_FLIGHT 16
+#define STREAM_RING_CHUNKS 4 /* chunks of streamed geometry in flight */
+#define DEFAULT_STREAM_CHUNK_TRIANGLES 65536 /* set by -chunk */
+#define GEOM_FILE_VERSION 2 /* bump whenever GeomFileHeader or MeshKey changes */
+#define GEOM_FILE_ALIGN 4096 /* streams start on page boundaries */
+#define DEFAULT_FRAG_LOOPS 256 /* -frag workload defaults */
+#define DEFAULT_FRAG_OPS 8
+#define DEFAULT_FRAG_CHAINS 1
+#define DEFAULT_FRAG_TRANS 0
+#define MAX_FRAG_OPS 64
+#define MAX_FRAG_CHAINS 8
+#define DIVERGE_TILE_PIXELS 32 /* -diverge 2 branch granularity */
+#define MAX_VERT_MATS 64 /* -vert workload limits */
+#define MAX_VERT_BONES 8
+#define VERT_CHAIN_UNIFORMS 16 /* the chained transforms cycle through these */
+#define VERT_PALETTE_BONES 32 /* matrix palette size for skinning */
+#define MAX_FETCH_ATTRIBS 16 /* -attribs: position, color, normal, texcoord, extras */
+#define FETCH_FIXED_ATTRIBS 4
+#define DEFAULT_FETCH_WIDTH 4 /* set by -attribwidth, floats per extra attribute */
+#define DEFAULT_TEX_SIZE 1024 /* set by -tex, texels on a side */
+#define MAX_TEX_SIZE 8192
+#define DEFAULT_TEX_FORMAT 0 /* set by -texfmt, an index into texFormats (RGBA8) */
+#define DEFAULT_TEX_SCALE 4.0 /* set by -texscale, texcoord multiplier for -texaccess 1 */
+#define MAX_TEX_ANISO 16
+#define MAX_COMPILE_VARIANTS 65536 /* -compilebench limits */
+#define MAX_COMPILE_THREADS 16
+#define COMPILE_VARIANT_OPTIONS 8 /* OPTION_n defines permuted across the variants */
+#define MAX_UNIFORM_OBJECTS 262144 /* -uniformbench limit */
+#define OBJECT_CONSTANTS_BINDING 1 /* -uniformbench's uniform block and SSBO */
+#define CORE_TRANSFORM_BINDING 0 /* uniform buffer binding of the -core Transform block */
 #define DEFAULT_CLEAR_PER_FRAME 0
 #define DEFAULT_OUTLINE_MODE_BOOL 1 /* 0 means draw filled tri's, 1 means outline */
 
+/* the generated fragment ALU loop, see -frag */
+typedef struct
+{
+  int loops;                  /* iterations, a uniform so it can't be unrolled away */
+  int ops;                    /* operations per iteration */
+  int chains;                 /* independent accumulators, 1 = one dependent chain */
+  int trans;                  /* how many of the ops are sin() rather than a MAD */
+  BranchMode branch;          /* set by -diverge */
+} FragWorkload;
+
+/* the generated vertex shader work, see -vert */
+typedef struct
+{
+  int mats;                   /* chained mat4 transforms */
+  int bones;                  /* palette matrices blended per vertex, 0 = no skinning */
+  int light;                  /* diffuse lighting from the mesh normals */
+} VertWorkload;
+
 typedef struct
 {
   char  *appName;             /* obtained from argv[0] */
   double triangleAreaInPixels; /* set by command line arg -a XXX */
   double testDurationSeconds; /* set by command line arg -s NNNN */
-  int    imgWidth, imgHeight; /* set by -w WWW -h HHH -- NOT IMPLEMENTED */
+  int    imgWidth, imgHeight; /* set by -w WWW -h HHH */
+  int    headless;            /* set by -headless */
+  int    coreProfile;         /* set by -core */
+  GLuint headlessFBO, headlessColorRB; /* render target when headless */
+  GLFWwindow *window;         /* NULL when headless */
 
   size_t triangleLimit;       /* set by -tl NNNN  */
   size_t vertexBufLimit;      /* set by -vl NNNN */
@@ -69,19 +249,88 @@ typedef struct
   int limitByFrames;
   int useFragShader;
   int useVertShader;
-
+  int fragWorkloadMode;       /* set by -frag SPEC */
+  FragWorkload fragWorkload;  /* set by -frag SPEC */
+  int vertWorkloadMode;       /* set by -vert SPEC */
+  VertWorkload vertWorkload;  /* set by -vert SPEC */
+  int vertCurve;              /* set by -vertcurve */
+  int fetchAttribs;           /* set by -attribs, 0 = the usual position + color */
+  int fetchWidth;             /* set by -attribwidth */
+  int fetchSweep;             /* set by -attribsweep */
+  int texMode;                /* set by -tex and the other -tex* options */
+  int texSize;                /* set by -tex NNNN */
+  int texFormat;              /* set by -texfmt, an index into texFormats */
+  TexFilter texFilter;        /* set by -texfilter (0, 1, 2) */
+  int texAniso;               /* set by -aniso, 1 = isotropic */
+  TexAccess texAccess;        /* set by -texaccess (0, 1, 2) */
+  double texScale;            /* set by -texscale */
+  int texAccessMatrix;        /* set by -texaccess all */
+
+  int    retainedMode;        /* set by -retained */
+  GLenum bufferUsage;         /* set by -bu (0, 1, 2) */
+
+  int    gpuTimers;           /* cleared by -notimers */
+  int    countFragments;      /* set by -countfrags */
+  int    sweepMode;           /* set by -sweep */
+  int    earlyStop;           /* end runs once the CI converges (sweep, matrix) */
+  double ciTolerance;         /* stop a run early once its CI is this tight, 0 = never */
 
   int    outlineMode;         /* set by -line */
-  TriangleType  triangleType;
+  TriangleType  triangleType;  /* set by -tt (0, 1, 2, 3) */
+  SubmitMode    submitMode;    /* set by -sm (0, 1, 2, 3, 4) */
+  PositionFormat positionFormat; /* set by -pf (0, 1, 2) */
+  ColorFormat   colorFormat;   /* set by -cf (0, 1, 2, 3, 4) */
+  int    interleaved;         /* set by -interleave */
+  int    meshThreads;         /* set by -threads, defaults to the CPU count */
+  int    compileVariants;     /* set by -compilebench */
+  int    compileThreads;      /* set by -compilethreads, defaults to the CPU count */
+  int    uniformObjects;      /* set by -uniformbench */
+  int    meshStreams;         /* MESH_STREAM_* bits something will bind */
+  int    lockMeshPages;       /* set by -mlock */
+  int    meshCacheMB;         /* set by -cachemb */
+  int    nTrials;             /* set by -trials */
+  char  *geomCacheDir;        /* set by -gc, NULL keeps meshes in memory only */
+  char  *shaderCacheDir;      /* set by -shadercache, NULL compiles every run */
+  int    streamMode;          /* set by -stream */
+  size_t streamTriangles;     /* set by -stream, 0 means one pass over the mesh */
+  size_t streamChunkTriangles; /* set by -chunk */
+  int    formatMatrix;        /* set by -vfmatrix */
+  UploadMode uploadMode;      /* set by -upload (1, 2, 3, 4, 5) */
+  int    uploadMatrix;        /* set by -upload all */
+  int    uploadFramesInFlight; /* set by -inflight */
+  int    divergeMatrix;       /* set by -diverge all */
+  int    indexBits;           /* set by -it (16, 32) */
 
 
   float  computedFPS;
   float  computedTrisPerSecond;
   float  computedMVertexOpsPerSecond;
-  float  computedMFragsPerSecond;
+  float  computedMFragsPerSecond;   /* estimate: tri rate * triangle area */
+  float  computedMeasuredMFragsPerSecond; /* GL_SAMPLES_PASSED, with -countfrags */
+  double computedFragsPerFrame;
+  int    computedFrames;
+  int    computedDrawsPerFrame;
+  double computedDrawsPerSecond;
+  double computedCpuNsPerDraw; /* CPU time inside the draw calls, per draw */
+  size_t computedBytesPerVertex;
   float  computedMTrisPerSecond;
   size_t computedVertsPerArrayCall; /* the number of verts issued in a glDrawArrays call */
   size_t computedIndicesPerArrayCall; /* the number of indices in glDrawElements call*/
+  size_t computedTransformedVertsPerFrame; /* verts missing a FIFO post-transform cache */
+  double computedFrameMs[4];  /* p50, p90, p99, max frame time; GPU if timed */
+  int    computedFrameMsFromGPU;
+  double computedMeshPeakMB;  /* arena high water mark for the run */
+  double computedStreamGBPerSecond; /* geometry written by -stream */
+  double computedStreamStallPercent; /* run time spent waiting on the ring */
+  double computedUploadGBPerSecond; /* positions pushed by -upload */
+  double computedUploadStallMsPerFrame; /* in upload calls and fence waits */
+  double computedFragGFlopsPerSecond; /* -frag workload */
+  double computedNsPerFragment;
+  double computedVertGFlopsPerSecond; /* -vert workload */
+  double computedFetchGBPerSecond; /* -attribs: vertex bytes fetched */
+  double computedGTexelsPerSecond; /* -tex: fragments x filter footprint */
+  double computedTexWorkingSetMB; /* estimated distinct texels touched per frame */
+  double computedTexReuse;    /* texel fetches per distinct texel, per frame */
 } AppState;
 
 /* global: I hate globals. GLUT doesn't appear to have a mechanism to
@@ -111,24 +360,213 @@ typedef struct
   unsigned char r, g, b, a;
 } Color4DUbyte;
 
+typedef struct
+{
+  GLenum type;
+  GLint  size;
+  GLsizei bytes;
+  const char *name;
+} AttribFormat;
+
+static const AttribFormat positionFormats[] =
+  {
+    {GL_FLOAT, 2, 8, "float"},
+    {GL_HALF_FLOAT, 2, 4, "half"},
+    {GL_SHORT, 2, 4, "short"},
+  };
+
+static const AttribFormat colorFormats[] =
+  {
+    {GL_FLOAT, 3, 12, "float"},
+    {GL_HALF_FLOAT, 4, 8, "half"},
+    {GL_SHORT, 4, 8, "norm short"},
+    {GL_UNSIGNED_BYTE, 4, 4, "ubyte"},
+    {GL_INT_2_10_10_10_REV, 4, 4, "2_10_10_10"},
+  };
+
+/* internal formats for -texfmt; the texels are uploaded as RGBA8 and converted */
+typedef struct
+{
+  GLenum internalFormat;
+  int    bytes;               /* nominal, the driver may pad */
+  const char *name;
+} TexFormat;
+
+static const TexFormat texFormats[] =
+  {
+    {GL_RGBA8, 4, "RGBA8"},
+    {GL_R3_G3_B2, 1, "R3_G3_B2"},
+    {GL_RGB565, 2, "RGB565"},
+    {GL_R8, 1, "R8"},
+    {GL_RGBA16F, 8, "RGBA16F"},
+    {GL_RGBA32F, 16, "RGBA32F"},
+  };
+
+/* the encoded dispatch streams: one interleaved stream, or one per attribute */
+typedef struct
+{
+  PositionFormat pf;
+  ColorFormat    cf;
+  int      interleaved;
+  int      nStreams;
+  void    *streams[2];
+  size_t   streamBytes[2];
+  GLsizei  stride[2];         /* position, color */
+  size_t   offset[2];
+  int      colorStream;       /* stream holding the colors */
+  float    positionScale;     /* POS_SHORT units per pixel */
+} VertexLayout;
+
 
 const char usageString[] =
   {" \
 [-a AAAA]\tsets triangle area in pixels (double precision value)\n \
 [-tl LLLL]\tsets maximum number of triangles (long int value)\n \
 [-s NNNN]\tsets the duration of the test in seconds.\n \
-[-w WWW -h HHH]\t sets the display window size.\n \
+[-w WWW -h HHH]\t sets the display window size (or the offscreen FBO size with -headless).\n \
+[-frag [spec]]\tshade with hello-gl.f.glsl, or with a generated ALU loop: loops=N,ops=N,chains=N,trans=N\n \
+[-vert [spec]]\ttransform with hello-gl.v.glsl, or with generated work: mats=N,bones=K,light=(0, 1)\n \
+[-attribs N]\tfetch N (1-16) attributes per vertex: position, color, normal, texcoord, then generated extras\n \
+[-attribwidth W]\tfloats (1-4) in each extra -attribs attribute\n \
+[-attribsweep]\trun -attribs 1 to 16 and tabulate vertex rate against bytes fetched per vertex\n \
+[-tex NNNN]\tsample an NNNN x NNNN texture with the mesh texcoords in every fragment\n \
+[-texfmt (0, 1, 2, 3, 4, 5)]\t-tex internal format: 0=RGBA8, 1=R3_G3_B2, 2=RGB565, 3=R8, 4=RGBA16F, 5=RGBA32F\n \
+[-texfilter (0, 1, 2)]\t-tex filtering: 0=nearest, 1=bilinear, 2=trilinear (mipmapped)\n \
+[-aniso NN]\tmaximum anisotropy (1-16) for the -tex texture\n \
+[-texaccess (0, 1, 2, all)]\t-tex access pattern: 0=coherent, 1=texcoords times -texscale, 2=random offset per triangle (-tt 0)\n \
+[-texscale FF]\ttexcoord multiplier for -texaccess 1 (default 4)\n \
+[-vertcurve]\trun the -vert workload with 0, 1, 2, 4 ... chained transforms and tabulate Mverts/sec\n \
+[-diverge (1, 2, 3, 4, all)]\tsplit the -frag workload three ways: 1=uniform branch, 2=tile-coherent, 3=per-pixel, 4=branch-free mix\n \
+[-headless]\tno window: create the context through EGL (surfaceless) and render into an FBO\n \
+[-core]\tcreate a GL 3.3 core profile context: VAO, generic attributes and a uniform block for the transform\n \
 [-df fname] sets the name of the dumpfile for performance statistics.\n \
 [-tt (0, 1, 2, 3)]\tset triangle type: 0=disjoint, 1=tstrip, 2=indexed disjoint, 3=indexed tstrip\n \
+[-sm (0, 1, 2, 3, 4)]\tsplit each frame into -vl sized draws: 0=single draw, 1=glDrawArrays loop,\n \
+\t\t2=glMultiDrawArrays, 3=glDrawArraysInstanced, 4=glMultiDrawArraysIndirect (-tt 0 only)\n \
+[-pf (0, 1, 2)]\tposition format: 0=float, 1=half float, 2=short fixed point\n \
+[-cf (0, 1, 2, 3, 4)]\tcolor format: 0=float RGB, 1=half RGBA, 2=normalized short RGBA, 3=ubyte RGBA, 4=GL_INT_2_10_10_10_REV\n \
+[-interleave]\tinterleave position and color into one stream instead of one array each\n \
+[-vfmatrix]\tbenchmark every position format x color format x layout combination\n \
+[-threads NN]\tnumber of threads building the meshes (default: one per CPU)\n \
+[-mlock]\tlock the mesh arrays into RAM\n \
+[-cachemb NN]\tmemory budget in MB for meshes kept between runs (0 disables)\n \
+[-trials NN]\trepeat the run NN times, reusing the mesh\n \
+[-gc dir]\tkeep generated meshes as files in dir and map them on later runs\n \
+[-compilebench NN]\tcompile NN #define variants of the hello-gl shaders serially, with KHR_parallel_shader_compile and on shared contexts\n \
+[-compilethreads NN]\tcompiler threads for -compilebench (default: one per CPU)\n \
+[-uniformbench NN]\tdraw NN quads a frame with per-object constants set by glUniform, a glBufferSubData UBO, a persistent UBO ring and an SSBO (-inflight sets the ring depth)\n \
+[-shadercache dir]\tkeep linked program binaries in dir and load them on later runs\n \
+[-upload (1, 2, 3, 4, 5, all)]\trotate the positions on the CPU and upload them each frame: orphan, subdata, map invalidate, map unsynchronized, persistent ring\n \
+[-inflight NN]\tframes in flight for the -upload 4 and 5 rings\n \
+[-stream NN]\tgenerate NN triangles per frame on the fly through a buffer ring (0: the whole mesh)\n \
+[-chunk NN]\ttriangles per streamed chunk\n \
+[-it (16, 32)]\tforce the index size for -tt 2 and 3 (default picks the smallest that fits)\n \
+[-notimers]\tdon't bracket frames with GL_TIME_ELAPSED queries (CPU frame times only)\n \
+[-countfrags]\tcount fragments actually drawn with GL_SAMPLES_PASSED queries\n \
+[-sweep]\tbisect triangle area for the vertex-bound/fill-bound crossover and fit the curve\n \
+[-ci TTTT]\tend each -sweep point once its 95%% CI is within this fraction of the mean (default 0.02)\n \
 [-line]\tSet polygon mode to GL_LINE to draw triangle outlines, no fill. \n \
+[-fill]\tSet polygon mode to GL_FILL to draw filled triangles. \n \
+[-retained]\tupload the dispatch arrays into buffer objects once and draw from them\n \
+[-bu (0, 1, 2)]\tbuffer usage for -retained: 0=GL_STATIC_DRAW, 1=GL_DYNAMIC_DRAW, 2=GL_STREAM_DRAW\n \
 \n"};
 
+/*
+ * -frag loops=N,ops=N,chains=N,trans=N: any subset, in any order.
+ * Each iteration does ops operations spread round robin over chains
+ * accumulators, trans of them sin() and the rest multiply-adds.
+ */
+static void
+parseFragWorkload(const char *spec, FragWorkload *fw)
+{
+  const char *p = spec;
+
+  while (*p != '\0')
+    {
+      char key[16];
+      int value, n;
+
+      if (sscanf(p, "%15[a-z]=%d%n", key, &value, &n) != 2)
+        {
+          fprintf(stderr,"Bad -frag workload spec: %s \n", spec);
+          exit(-1);
+        }
+      if (strcmp(key, "loops") == 0)
+        fw->loops = value;
+      else if (strcmp(key, "ops") == 0)
+        fw->ops = value;
+      else if (strcmp(key, "chains") == 0)
+        fw->chains = value;
+      else if (strcmp(key, "trans") == 0)
+        fw->trans = value;
+      else
+        {
+          fprintf(stderr,"Unknown -frag workload parameter: %s \n", key);
+          exit(-1);
+        }
+      p += n;
+      if (*p == ',')
+        p++;
+    }
+
+  if (fw->loops < 0 || fw->ops < 1 || fw->ops > MAX_FRAG_OPS ||
+      fw->chains < 1 || fw->chains > MAX_FRAG_CHAINS ||
+      fw->trans < 0 || fw->trans > fw->ops)
+    {
+      fprintf(stderr,"-frag needs loops >= 0, 1 <= ops <= %d, 1 <= chains <= %d, 0 <= trans <= ops \n",
+              MAX_FRAG_OPS, MAX_FRAG_CHAINS);
+      exit(-1);
+    }
+}
+
+/* -vert mats=N,bones=K,light=(0, 1): any subset, in any order */
+static void
+parseVertWorkload(const char *spec, VertWorkload *vw)
+{
+  const char *p = spec;
+
+  while (*p != '\0')
+    {
+      char key[16];
+      int value, n;
+
+      if (sscanf(p, "%15[a-z]=%d%n", key, &value, &n) != 2)
+        {
+          fprintf(stderr,"Bad -vert workload spec: %s \n", spec);
+          exit(-1);
+        }
+      if (strcmp(key, "mats") == 0)
+        vw->mats = value;
+      else if (strcmp(key, "bones") == 0)
+        vw->bones = value;
+      else if (strcmp(key, "light") == 0)
+        vw->light = value != 0;
+      else
+        {
+          fprintf(stderr,"Unknown -vert workload parameter: %s \n", key);
+          exit(-1);
+        }
+      p += n;
+      if (*p == ',')
+        p++;
+    }
+
+  if (vw->mats < 0 || vw->mats > MAX_VERT_MATS ||
+      vw->bones < 0 || vw->bones > MAX_VERT_BONES)
+    {
+      fprintf(stderr,"-vert needs 0 <= mats <= %d and 0 <= bones <= %d \n",
+              MAX_VERT_MATS, MAX_VERT_BONES);
+      exit(-1);
+    }
+}
+
 void
 parseArgs(int argc,
           char **argv,
           AppState *myAppState)
 {
   int i=1;
+  int outlineRequested = 0;   /* -line given, rather than the default */
   argc--;
   while (argc > 0)
     {
@@ -150,6 +588,27 @@ parseArgs(int argc,
           argc--;
           myAppState->testDurationSeconds = atof(argv[i]);
         }
+      else if (strcmp(argv[i],"-w") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->imgWidth = atoi(argv[i]);
+        }
+      else if (strcmp(argv[i],"-h") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->imgHeight = atoi(argv[i]);
+        }
+      else if (strcmp(argv[i], "-headless") == 0)
+        {
+#if WESBENCH_HEADLESS
+          myAppState->headless = 1;
+#else
+          fprintf(stderr,"-headless is not available in this build \n");
+          exit(-1);
+#endif
+        }
       else if (strcmp(argv[i], "-nf") == 0) 
       {
         i++;
@@ -159,10 +618,162 @@ parseArgs(int argc,
       }
       else if (strcmp(argv[i], "-frag") == 0) {
         myAppState->useFragShader = 1;
+        if (argc > 1 && argv[i+1][0] != '-') {
+          i++;
+          argc--;
+          parseFragWorkload(argv[i], &myAppState->fragWorkload);
+          myAppState->fragWorkloadMode = 1;
+        }
       }
+      else if (strcmp(argv[i],"-diverge") == 0)
+        {
+          int m;
+          i++;
+          argc--;
+          if (strcmp(argv[i], "all") == 0)
+            {
+              myAppState->divergeMatrix = 1;
+              m = BRANCH_UNIFORM;
+            }
+          else
+            m = atoi(argv[i]);
+          if (m < BRANCH_UNIFORM || m > BRANCH_MIX)
+            {
+              fprintf(stderr,"Divergence mode must be 1, 2, 3, 4 or all: %s \n", argv[i]);
+              exit(-1);
+            }
+          /* the branches wrap the -frag workload, with its defaults if no spec */
+          myAppState->fragWorkload.branch = (BranchMode)m;
+          myAppState->useFragShader = 1;
+          myAppState->fragWorkloadMode = 1;
+          /* compare time per fragment actually shaded, not the area estimate */
+          myAppState->countFragments = 1;
+        }
       else if (strcmp(argv[i], "-vert") == 0) {
         myAppState->useVertShader = 1;
+        if (argc > 1 && argv[i+1][0] != '-') {
+          i++;
+          argc--;
+          parseVertWorkload(argv[i], &myAppState->vertWorkload);
+          myAppState->vertWorkloadMode = 1;
+        }
       }
+      else if (strcmp(argv[i],"-attribs") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->fetchAttribs = atoi(argv[i]);
+          if (myAppState->fetchAttribs < 1 || myAppState->fetchAttribs > MAX_FETCH_ATTRIBS)
+            {
+              fprintf(stderr,"-attribs must be 1 to %d: %s \n", MAX_FETCH_ATTRIBS, argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i],"-attribwidth") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->fetchWidth = atoi(argv[i]);
+          if (myAppState->fetchWidth < 1 || myAppState->fetchWidth > 4)
+            {
+              fprintf(stderr,"-attribwidth must be 1, 2, 3 or 4: %s \n", argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i], "-attribsweep") == 0)
+        {
+          myAppState->fetchSweep = 1;
+          myAppState->fetchAttribs = 1;
+        }
+      else if (strcmp(argv[i],"-tex") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->texMode = 1;
+          myAppState->texSize = atoi(argv[i]);
+          if (myAppState->texSize < 1 || myAppState->texSize > MAX_TEX_SIZE)
+            {
+              fprintf(stderr,"-tex must be 1 to %d texels: %s \n", MAX_TEX_SIZE, argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i],"-texfmt") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->texMode = 1;
+          myAppState->texFormat = atoi(argv[i]);
+          if (myAppState->texFormat < 0 ||
+              myAppState->texFormat >= (int)(sizeof(texFormats)/sizeof(texFormats[0])))
+            {
+              fprintf(stderr,"Texture format must be 0, 1, 2, 3, 4 or 5: %s \n", argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i],"-texfilter") == 0)
+        {
+          int t;
+          i++;
+          argc--;
+          t = atoi(argv[i]);
+          if (t < TEX_NEAREST || t > TEX_TRILINEAR)
+            {
+              fprintf(stderr,"Texture filter must be 0, 1 or 2: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->texMode = 1;
+          myAppState->texFilter = (TexFilter)t;
+        }
+      else if (strcmp(argv[i],"-aniso") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->texMode = 1;
+          myAppState->texAniso = atoi(argv[i]);
+          if (myAppState->texAniso < 1 || myAppState->texAniso > MAX_TEX_ANISO)
+            {
+              fprintf(stderr,"-aniso must be 1 to %d: %s \n", MAX_TEX_ANISO, argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i],"-texaccess") == 0)
+        {
+          int t;
+          i++;
+          argc--;
+          if (strcmp(argv[i], "all") == 0)
+            {
+              myAppState->texAccessMatrix = 1;
+              t = TEX_COHERENT;
+            }
+          else
+            t = atoi(argv[i]);
+          if (t < TEX_COHERENT || t > TEX_RANDOM)
+            {
+              fprintf(stderr,"Texture access must be 0, 1, 2 or all: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->texMode = 1;
+          myAppState->texAccess = (TexAccess)t;
+        }
+      else if (strcmp(argv[i],"-texscale") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->texMode = 1;
+          myAppState->texScale = atof(argv[i]);
+          if (myAppState->texScale <= 0.0)
+            {
+              fprintf(stderr,"-texscale must be positive: %s \n", argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i], "-vertcurve") == 0)
+        {
+          myAppState->vertCurve = 1;
+          myAppState->useVertShader = 1;
+          myAppState->vertWorkloadMode = 1;
+        }
       else if (strcmp(argv[i],"-tl") == 0)
         {
           i++;
@@ -175,9 +786,248 @@ parseArgs(int argc,
           argc--;
           myAppState->vertexBufLimit = atoi(argv[i]);
         }
+      else if (strcmp(argv[i],"-tt") == 0)
+        {
+          int t;
+          i++;
+          argc--;
+          t = atoi(argv[i]);
+          if (t < DISJOINT_TRIANGLES || t > INDEXED_TRIANGLE_STRIPS)
+            {
+              fprintf(stderr,"Triangle type must be 0, 1, 2 or 3: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->triangleType = (TriangleType)t;
+        }
+      else if (strcmp(argv[i],"-sm") == 0)
+        {
+          int m;
+          i++;
+          argc--;
+          m = atoi(argv[i]);
+          if (m < SUBMIT_SINGLE_DRAW || m > SUBMIT_INDIRECT)
+            {
+              fprintf(stderr,"Submission mode must be 0, 1, 2, 3 or 4: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->submitMode = (SubmitMode)m;
+        }
+      else if (strcmp(argv[i],"-pf") == 0)
+        {
+          int f;
+          i++;
+          argc--;
+          f = atoi(argv[i]);
+          if (f < POS_FLOAT || f > POS_SHORT)
+            {
+              fprintf(stderr,"Position format must be 0, 1 or 2: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->positionFormat = (PositionFormat)f;
+        }
+      else if (strcmp(argv[i],"-cf") == 0)
+        {
+          int f;
+          i++;
+          argc--;
+          f = atoi(argv[i]);
+          if (f < COLOR_FLOAT || f > COLOR_INT_2_10_10_10)
+            {
+              fprintf(stderr,"Color format must be 0, 1, 2, 3 or 4: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->colorFormat = (ColorFormat)f;
+        }
+      else if (strcmp(argv[i], "-interleave") == 0)
+        {
+          myAppState->interleaved = 1;
+        }
+      else if (strcmp(argv[i], "-vfmatrix") == 0)
+        {
+          myAppState->formatMatrix = 1;
+        }
+      else if (strcmp(argv[i],"-threads") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->meshThreads = atoi(argv[i]);
+          if (myAppState->meshThreads < 1)
+            myAppState->meshThreads = 1;
+          if (myAppState->meshThreads > MAX_MESH_THREADS)
+            myAppState->meshThreads = MAX_MESH_THREADS;
+        }
+      else if (strcmp(argv[i],"-compilebench") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->compileVariants = atoi(argv[i]);
+          if (myAppState->compileVariants < 1 ||
+              myAppState->compileVariants > MAX_COMPILE_VARIANTS)
+            {
+              fprintf(stderr,"-compilebench must be 1 to %d variants: %s \n", MAX_COMPILE_VARIANTS, argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i],"-compilethreads") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->compileThreads = atoi(argv[i]);
+          if (myAppState->compileThreads < 1)
+            myAppState->compileThreads = 1;
+          if (myAppState->compileThreads > MAX_COMPILE_THREADS)
+            myAppState->compileThreads = MAX_COMPILE_THREADS;
+        }
+      else if (strcmp(argv[i],"-uniformbench") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->uniformObjects = atoi(argv[i]);
+          if (myAppState->uniformObjects < 1 ||
+              myAppState->uniformObjects > MAX_UNIFORM_OBJECTS)
+            {
+              fprintf(stderr,"-uniformbench must be 1 to %d objects: %s \n", MAX_UNIFORM_OBJECTS, argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i],"-mlock") == 0)
+        myAppState->lockMeshPages = 1;
+      else if (strcmp(argv[i],"-cachemb") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->meshCacheMB = atoi(argv[i]);
+          if (myAppState->meshCacheMB < 0)
+            myAppState->meshCacheMB = 0;
+        }
+      else if (strcmp(argv[i],"-gc") == 0)
+        {
+          i++;
+          argc--;
+#ifdef _WIN32
+          fprintf(stderr," -gc isn't supported on this platform, ignoring it. \n");
+#else
+          myAppState->geomCacheDir = argv[i];
+#endif
+        }
+      else if (strcmp(argv[i],"-shadercache") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->shaderCacheDir = argv[i];
+        }
+      else if (strcmp(argv[i],"-upload") == 0)
+        {
+          int m;
+          i++;
+          argc--;
+          if (strcmp(argv[i], "all") == 0)
+            {
+              myAppState->uploadMatrix = 1;
+              m = UPLOAD_ORPHAN;
+            }
+          else
+            m = atoi(argv[i]);
+          if (m < UPLOAD_ORPHAN || m > UPLOAD_PERSISTENT)
+            {
+              fprintf(stderr,"Upload strategy must be 1, 2, 3, 4, 5 or all: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->uploadMode = (UploadMode)m;
+        }
+      else if (strcmp(argv[i],"-inflight") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->uploadFramesInFlight = atoi(argv[i]);
+          if (myAppState->uploadFramesInFlight < 1)
+            myAppState->uploadFramesInFlight = 1;
+          if (myAppState->uploadFramesInFlight > MAX_UPLOAD_FRAMES_IN_FLIGHT)
+            myAppState->uploadFramesInFlight = MAX_UPLOAD_FRAMES_IN_FLIGHT;
+        }
+      else if (strcmp(argv[i],"-stream") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->streamMode = 1;
+          myAppState->streamTriangles = (size_t)atof(argv[i]);
+        }
+      else if (strcmp(argv[i],"-chunk") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->streamChunkTriangles = (size_t)atof(argv[i]);
+          if (myAppState->streamChunkTriangles < 1)
+            myAppState->streamChunkTriangles = 1;
+        }
+      else if (strcmp(argv[i],"-trials") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->nTrials = atoi(argv[i]);
+          if (myAppState->nTrials < 1)
+            myAppState->nTrials = 1;
+        }
+      else if (strcmp(argv[i],"-it") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->indexBits = atoi(argv[i]);
+          if (myAppState->indexBits != 16 && myAppState->indexBits != 32)
+            {
+              fprintf(stderr,"Index size must be 16 or 32: %s \n", argv[i]);
+              exit(-1);
+            }
+        }
+      else if (strcmp(argv[i], "-notimers") == 0)
+        {
+          myAppState->gpuTimers = 0;
+        }
+      else if (strcmp(argv[i], "-sweep") == 0)
+        {
+          myAppState->sweepMode = 1;
+        }
+      else if (strcmp(argv[i],"-ci") == 0)
+        {
+          i++;
+          argc--;
+          myAppState->ciTolerance = atof(argv[i]);
+        }
+      else if (strcmp(argv[i], "-countfrags") == 0)
+        {
+          myAppState->countFragments = 1;
+        }
       else if (strcmp(argv[i], "-line") == 0)
         {
           myAppState->outlineMode = 1;
+          outlineRequested = 1;
+        }
+      else if (strcmp(argv[i], "-fill") == 0)
+        {
+          myAppState->outlineMode = 0;
+          outlineRequested = 0;
+        }
+      else if (strcmp(argv[i], "-core") == 0)
+        {
+          myAppState->coreProfile = 1;
+        }
+      else if (strcmp(argv[i], "-retained") == 0)
+        {
+          myAppState->retainedMode = 1;
+        }
+      else if (strcmp(argv[i],"-bu") == 0)
+        {
+          static const GLenum usages[] = {GL_STATIC_DRAW, GL_DYNAMIC_DRAW, GL_STREAM_DRAW};
+          int u;
+          i++;
+          argc--;
+          u = atoi(argv[i]);
+          if (u < 0 || u > 2)
+            {
+              fprintf(stderr,"Buffer usage must be 0, 1 or 2: %s \n", argv[i]);
+              exit(-1);
+            }
+          myAppState->bufferUsage = usages[u];
         }
       else
         {
@@ -187,625 +1037,5696 @@ parseArgs(int argc,
       i++;
       argc--;
     }
-}
-
-void normalizeNormal(Vertex3D *n)
-{
-  double d = n->x*n->x + n->y*n->y + n->z*n->z;
-  d = sqrt(d);
-  if (d != 0.0)
-    d = 1.0/d;
-  n->x *= d;
-  n->y *= d;
-  n->z *= d;
-}
 
-void
-buildDisjointTriangleArrays(int nVertsPerAxis,
-                            int triangleLimit,
-                            int *dispatchTriangles,
-                            int *dispatchVertexCount,
-                            Vertex2D *baseVerts,
-                            Color3D *baseColors,
-                            Vertex3D *baseNormals,
-                            Vertex2D *baseTCs,
-                            Vertex2D **dispatchVerts,
-                            Color3D **dispatchColors,
-                            Vertex3D **dispatchNormals,
-                            Vertex2D **dispatchTCs)
+  if (myAppState->submitMode != SUBMIT_SINGLE_DRAW &&
+      myAppState->triangleType != DISJOINT_TRIANGLES)
+    {
+      fprintf(stderr,"-sm %d needs disjoint triangles (-tt 0) \n", myAppState->submitMode);
+      exit(-1);
+    }
+  if (myAppState->submitMode == SUBMIT_INSTANCED &&
+      (myAppState->positionFormat != POS_FLOAT ||
+       myAppState->colorFormat != COLOR_FLOAT ||
+       myAppState->interleaved || myAppState->formatMatrix))
+    {
+      fprintf(stderr,"-sm 3 only draws the default float vertex format \n");
+      exit(-1);
+    }
+  if (myAppState->streamMode &&
+      (myAppState->triangleType != DISJOINT_TRIANGLES ||
+       myAppState->submitMode != SUBMIT_SINGLE_DRAW ||
+       myAppState->positionFormat != POS_FLOAT ||
+       myAppState->colorFormat != COLOR_FLOAT || myAppState->formatMatrix))
+    {
+      fprintf(stderr,"-stream generates float disjoint triangles, drawn one chunk at a time \n");
+      exit(-1);
+    }
+  if (myAppState->uploadMode != UPLOAD_NONE &&
+      (myAppState->submitMode != SUBMIT_SINGLE_DRAW || myAppState->streamMode ||
+       myAppState->positionFormat != POS_FLOAT || myAppState->interleaved ||
+       myAppState->formatMatrix || myAppState->sweepMode))
+    {
+      fprintf(stderr,"-upload rewrites separate float positions for a single draw per frame \n");
+      exit(-1);
+    }
+  if (myAppState->coreProfile &&
+      (myAppState->submitMode == SUBMIT_INSTANCED ||
+       (myAppState->useFragShader && !myAppState->fragWorkloadMode) ||
+       (myAppState->useVertShader && !myAppState->vertWorkloadMode)))
+    {
+      fprintf(stderr,"-core can't run -sm 3, or -vert or -frag without a workload spec: their shaders are GLSL 1.x \n");
+      exit(-1);
+    }
+  /* a fragment workload is priced per covered pixel, which outlines barely touch */
+  if (myAppState->fragWorkloadMode)
+    {
+      if (outlineRequested)
+        {
+          fprintf(stderr,"-frag workloads and -diverge shade filled triangles, so they can't run with -line \n");
+          exit(-1);
+        }
+      myAppState->outlineMode = 0;
+    }
+  if (myAppState->vertWorkloadMode &&
+      (myAppState->submitMode == SUBMIT_INSTANCED ||
+       (myAppState->vertWorkload.light && myAppState->streamMode)))
+    {
+      fprintf(stderr,"-vert workloads don't apply to -sm 3, and -stream has no normals to light \n");
+      exit(-1);
+    }
+  if (myAppState->vertWorkloadMode && myAppState->vertWorkload.light)
+    myAppState->meshStreams |= MESH_STREAM_NORMALS;
+  if (myAppState->fetchAttribs > 0 &&
+      (myAppState->useVertShader || myAppState->streamMode ||
+       myAppState->submitMode == SUBMIT_INSTANCED))
+    {
+      fprintf(stderr,"-attribs brings its own vertex shader, and needs the mesh: no -vert, -stream or -sm 3 \n");
+      exit(-1);
+    }
+  /* -attribs draws from buffers, and the sweep shares one mesh between points */
+  if (myAppState->fetchAttribs > 0)
+    {
+      myAppState->retainedMode = 1;
+      if (myAppState->fetchSweep || myAppState->fetchAttribs > 2)
+        myAppState->meshStreams |= MESH_STREAM_NORMALS;
+      if (myAppState->fetchSweep || myAppState->fetchAttribs > 3)
+        myAppState->meshStreams |= MESH_STREAM_TCS;
+    }
+  if (myAppState->texMode &&
+      (myAppState->useVertShader || myAppState->useFragShader ||
+       myAppState->fetchAttribs > 0 || myAppState->streamMode ||
+       myAppState->submitMode == SUBMIT_INSTANCED))
+    {
+      fprintf(stderr,"-tex brings its own shaders, and needs the mesh texcoords: no -vert, -frag, -attribs, -stream or -sm 3 \n");
+      exit(-1);
+    }
+  if (myAppState->texMode &&
+      (myAppState->texAccess == TEX_RANDOM || myAppState->texAccessMatrix) &&
+      myAppState->triangleType != DISJOINT_TRIANGLES)
+    {
+      fprintf(stderr,"-texaccess 2 moves whole triangles, so it needs -tt 0 \n");
+      exit(-1);
+    }
+  if (myAppState->texMode && outlineRequested)
+    {
+      fprintf(stderr,"-tex samples across filled triangles, so it can't run with -line \n");
+      exit(-1);
+    }
+  /* the texcoords are drawn from the mesh's buffer objects; the sample
+     rate and cache figures count the fragments actually drawn */
+  if (myAppState->texMode)
+    {
+      myAppState->retainedMode = 1;
+      myAppState->meshStreams |= MESH_STREAM_TCS;
+      myAppState->outlineMode = 0;
+      myAppState->countFragments = 1;
+    }
+  if (myAppState->compileVariants > 0 && myAppState->coreProfile)
+    {
+      fprintf(stderr,"-compilebench compiles the GLSL 1.10 hello-gl shaders, so it can't run with -core \n");
+      exit(-1);
+    }
+  /* a core profile has no client-side arrays */
+  if (myAppState->coreProfile)
+    myAppState->retainedMode = 1;
+  /* -upload keeps the colors and indices in static buffer objects */
+  if (myAppState->uploadMode != UPLOAD_NONE)
+    myAppState->retainedMode = 1;
+  /* instanced and indirect draws source their vertices from buffer objects */
+  if (myAppState->submitMode == SUBMIT_INSTANCED ||
+      myAppState->submitMode == SUBMIT_INDIRECT)
+    myAppState->retainedMode = 1;
+}
+
+/* number of online CPUs, the default for -threads */
+static int
+wesCpuCount(void)
 {
+  int n;
+#ifdef _WIN32
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  n = (int)si.dwNumberOfProcessors;
+#else
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (n < 1)
+    n = 1;
+  if (n > MAX_MESH_THREADS)
+    n = MAX_MESH_THREADS;
+  return n;
+}
 
-  /* now, create and populate the arrays that will be used to dispatch
-     triangle data off to OpenGL */
+/*
+ * Run fn(ctx, begin, end) over [0, nItems) split into one contiguous
+ * range per thread; the calling thread takes the first range. Small
+ * jobs (itemCost*nItems below MESH_PARALLEL_MIN_ITEMS) run inline.
+ */
+typedef void (*RangeFunc)(void *ctx, int begin, int end);
+
+typedef struct
+{
+  RangeFunc fn;
+  void *ctx;
+  int begin, end;
+} RangeJob;
+
+#ifdef _WIN32
+static DWORD WINAPI
+rangeJobThread(LPVOID arg)
+{
+  RangeJob *job = (RangeJob *)arg;
+  job->fn(job->ctx, job->begin, job->end);
+  return 0;
+}
+#else
+static void *
+rangeJobThread(void *arg)
+{
+  RangeJob *job = (RangeJob *)arg;
+  job->fn(job->ctx, job->begin, job->end);
+  return NULL;
+}
+#endif
+
+static void
+wesParallelFor(int nThreads, int nItems, size_t itemCost, RangeFunc fn, void *ctx)
+{
+  RangeJob jobs[MAX_MESH_THREADS];
+#ifdef _WIN32
+  HANDLE threads[MAX_MESH_THREADS];
+#else
+  pthread_t threads[MAX_MESH_THREADS];
+#endif
+  int started[MAX_MESH_THREADS];
+  int t, per;
+
+  if (nThreads > nItems)
+    nThreads = nItems;
+  if (nThreads <= 1 || (size_t)nItems*itemCost < MESH_PARALLEL_MIN_ITEMS)
+    {
+      if (nItems > 0)
+        fn(ctx, 0, nItems);
+      return;
+    }
+
+  per = (nItems + nThreads - 1)/nThreads;
+  for (t=0;t<nThreads;t++)
+    {
+      jobs[t].fn = fn;
+      jobs[t].ctx = ctx;
+      jobs[t].begin = t*per;
+      jobs[t].end = (t+1)*per < nItems ? (t+1)*per : nItems;
+      started[t] = 0;
+    }
+  for (t=1;t<nThreads;t++)
+    {
+      if (jobs[t].begin >= jobs[t].end)
+        continue;
+#ifdef _WIN32
+      threads[t] = CreateThread(NULL, 0, rangeJobThread, &jobs[t], 0, NULL);
+      started[t] = (threads[t] != NULL);
+#else
+      started[t] = (pthread_create(&threads[t], NULL, rangeJobThread, &jobs[t]) == 0);
+#endif
+      if (!started[t])          /* no thread to be had, do it ourselves */
+        fn(ctx, jobs[t].begin, jobs[t].end);
+    }
+  fn(ctx, jobs[0].begin, jobs[0].end);
+  for (t=1;t<nThreads;t++)
+    if (started[t])
+      {
+#ifdef _WIN32
+        WaitForSingleObject(threads[t], INFINITE);
+        CloseHandle(threads[t]);
+#else
+        pthread_join(threads[t], NULL);
+#endif
+      }
+}
+
+/*
+ * The base and dispatch arrays of a mesh come out of one arena. Memory
+ * is mapped in 2MB aligned blocks, advised for transparent huge pages
+ * and optionally locked. Blocks of a released arena go to a spare pool
+ * rather than back to the system, so sweep and matrix points reuse
+ * pages that are already faulted in instead of repeating the
+ * malloc/free/page fault cycle for every point.
+ */
+typedef struct ArenaBlock
+{
+  struct ArenaBlock *next;
+  size_t size, used;          /* bytes, including this header */
+  int locked;
+  int hugeAdvised;            /* MADV_HUGEPAGE took */
+} ArenaBlock;
+
+typedef struct
+{
+  ArenaBlock *blocks;
+  size_t inUse;               /* bytes handed out */
+  int lockPages;
+} MeshArena;
+
+/* totals over every arena, and the blocks waiting to be reused */
+static struct
+{
+  size_t inUse, peak;
+  size_t mapped, locked, hugeAdvised, spareBytes;
+  ArenaBlock *spare;
+} arenaPool;
+
+static size_t
+roundUpBytes(size_t n, size_t to)
+{
+  return (n + to - 1)/to*to;
+}
+
+static void
+arenaLockBlock(ArenaBlock *b)
+{
+#ifdef _WIN32
+  b->locked = VirtualLock(b, b->size) != 0;
+#else
+  b->locked = (mlock(b, b->size) == 0);
+  if (!b->locked)
+    fprintf(stderr, " Warning: couldn't lock %zu MB of mesh memory (see ulimit -l) \n",
+            b->size>>20);
+#endif
+  if (b->locked)
+    arenaPool.locked += b->size;
+}
+
+static ArenaBlock *
+arenaMapBlock(MeshArena *a, size_t size)
+{
+  unsigned char *p;
+  ArenaBlock *b, **link;
+  int hugeAdvised = 0;
+
+  /* a spare block that's big enough, but not wastefully so */
+  for (link=&arenaPool.spare;*link!=NULL;link=&(*link)->next)
+    if ((*link)->size >= size && (*link)->size <= 2*size)
+      break;
+  if (*link != NULL)
+    {
+      b = *link;
+      *link = b->next;
+      arenaPool.spareBytes -= b->size;
+    }
+  else
+    {
+#ifdef _WIN32
+      p = (unsigned char *)VirtualAlloc(NULL, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+      if (p == NULL)
+        return NULL;
+#else
+      {
+        /* over-map by a huge page, then trim so the block starts 2MB aligned */
+        size_t slop = ARENA_PAGE_BYTES;
+        unsigned char *raw = (unsigned char *)mmap(NULL, size + slop, PROT_READ|PROT_WRITE,
+                                                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        size_t head;
+
+        if (raw == (unsigned char *)MAP_FAILED)
+          return NULL;
+        head = (ARENA_PAGE_BYTES - (size_t)raw % ARENA_PAGE_BYTES) % ARENA_PAGE_BYTES;
+        if (head)
+          munmap(raw, head);
+        if (slop - head)
+          munmap(raw + head + size, slop - head);
+        p = raw + head;
+      }
+#ifdef MADV_HUGEPAGE
+      if (madvise(p, size, MADV_HUGEPAGE) == 0)
+        {
+          hugeAdvised = 1;
+          arenaPool.hugeAdvised += size;
+        }
+#endif
+#endif
+      b = (ArenaBlock *)p;
+      b->size = size;
+      b->locked = 0;
+      b->hugeAdvised = hugeAdvised;
+      arenaPool.mapped += size;
+    }
+
+  if (a->lockPages && !b->locked)
+    arenaLockBlock(b);
+  b->used = roundUpBytes(sizeof(ArenaBlock), ARENA_ALIGN);
+  b->next = a->blocks;
+  a->blocks = b;
+  return b;
+}
+
+static void
+arenaUnmapBlock(ArenaBlock *b)
+{
+  arenaPool.mapped -= b->size;
+  if (b->locked)
+    arenaPool.locked -= b->size;
+#ifdef _WIN32
+  VirtualFree(b, 0, MEM_RELEASE);
+#else
+  if (b->hugeAdvised)
+    arenaPool.hugeAdvised -= b->size;
+  munmap(b, b->size);
+#endif
+}
+
+/* NULL when the system can't map another block */
+static void *
+arenaAlloc(MeshArena *a, size_t bytes)
+{
+  ArenaBlock *b;
+  void *p;
+
+  bytes = roundUpBytes(bytes ? bytes : 1, ARENA_ALIGN);
+  for (b=a->blocks;b!=NULL;b=b->next)
+    if (b->size - b->used >= bytes)
+      break;
+  if (b == NULL)
+    {
+      size_t size = roundUpBytes(bytes + roundUpBytes(sizeof(ArenaBlock), ARENA_ALIGN),
+                                 ARENA_PAGE_BYTES);
+      if (size < ARENA_MIN_BLOCK_BYTES)
+        size = ARENA_MIN_BLOCK_BYTES;
+      if (size < bytes || (b = arenaMapBlock(a, size)) == NULL)
+        return NULL;
+    }
+
+  p = (unsigned char *)b + b->used;
+  b->used += bytes;
+  a->inUse += bytes;
+  arenaPool.inUse += bytes;
+  if (arenaPool.inUse > arenaPool.peak)
+    arenaPool.peak = arenaPool.inUse;
+  return p;
+}
+
+/* mesh arrays can be gigabytes; running out is reported, not crashed on */
+static void *
+arenaAllocOrDie(MeshArena *a, size_t count, size_t size, const char *what)
+{
+  void *p = NULL;
+
+  if (size == 0 || count <= ((size_t)-1)/size)
+    p = arenaAlloc(a, count*size);
+  if (p == NULL)
+    {
+      fprintf(stderr, "Error: out of memory allocating %.1f MB for %s (%.1f MB already in use). Try a larger -a or a smaller -tl/-vl.\n",
+              (double)count*size/(1024.0*1024.0), what,
+              (double)arenaPool.inUse/(1024.0*1024.0));
+      exit(1);
+    }
+  return p;
+}
+
+/* hand the arena's blocks to the spare pool, unmapping what won't fit */
+static void
+arenaRelease(MeshArena *a)
+{
+  while (a->blocks != NULL)
+    {
+      ArenaBlock *b = a->blocks;
+      a->blocks = b->next;
+      if (arenaPool.spareBytes + b->size <= ARENA_SPARE_LIMIT_BYTES)
+        {
+          b->next = arenaPool.spare;
+          arenaPool.spare = b;
+          arenaPool.spareBytes += b->size;
+        }
+      else
+        arenaUnmapBlock(b);
+    }
+  arenaPool.inUse -= a->inUse;
+  a->inUse = 0;
+}
+
+/* unmap the spare pool; every arena must have been released already */
+static void
+arenaPoolRelease(void)
+{
+  while (arenaPool.spare != NULL)
+    {
+      ArenaBlock *b = arenaPool.spare;
+      arenaPool.spare = b->next;
+      arenaUnmapBlock(b);
+    }
+  arenaPool.spareBytes = 0;
+}
 
-  int i, j, sIndx, dIndx;
+/*
+ * Per-row kernels for buildDisjointTriangleArrays. Each row of quads
+ * owns a fixed slice of the output, so rows can be filled concurrently,
+ * and each stream is copied in its own loop over the row so the compiler
+ * can keep the loops tight.
+ */
+typedef struct
+{
+  int nVertsPerAxis;
+  size_t nTriangles;
+  const Vertex2D *baseVerts;
+  const Color3D *baseColors;
+  const Vertex3D *baseNormals;
+  const Vertex2D *baseTCs;
   Vertex2D *dv, *dtc;
   Color3D *dc;
   Vertex3D *dn;
-  *dispatchTriangles = nVertsPerAxis*nVertsPerAxis*2;
+} DisjointBuild;
+
+/* the six base-mesh indices of quad (i,j): triangles (0,1,n+1), (n+1,1,n+2) */
+#define DISJOINT_QUAD_COPY(dst, src, d, s, n)   \
+  do {                                          \
+    (dst)[(d)+0] = (src)[(s)];                  \
+    (dst)[(d)+1] = (src)[(s)+1];                \
+    (dst)[(d)+2] = (src)[(s)+(n)+1];            \
+    (dst)[(d)+3] = (src)[(s)+(n)+1];            \
+    (dst)[(d)+4] = (src)[(s)+1];                \
+    (dst)[(d)+5] = (src)[(s)+1+(n)+1];          \
+  } while (0)
+
+static void
+buildDisjointRows(void *ctx, int rowBegin, int rowEnd)
+{
+  DisjointBuild *db = (DisjointBuild *)ctx;
+  int n = db->nVertsPerAxis;
+  int i, j;
+
+  for (j=rowBegin;j<rowEnd;j++)
+    {
+      /* quads in this row that are (at least partly) within the limit */
+      size_t q0 = (size_t)j*n;
+      size_t nQuads = (db->nTriangles + 1)/2 - q0;
+      if (nQuads > (size_t)n)
+        nQuads = n;
+
+      for (i=0;i<(int)nQuads;i++)
+        DISJOINT_QUAD_COPY(db->dv, db->baseVerts, (q0+i)*6, (size_t)j*(n+1)+i, n);
+      for (i=0;i<(int)nQuads;i++)
+        DISJOINT_QUAD_COPY(db->dc, db->baseColors, (q0+i)*6, (size_t)j*(n+1)+i, n);
+      if (db->dn != NULL)
+        for (i=0;i<(int)nQuads;i++)
+          DISJOINT_QUAD_COPY(db->dn, db->baseNormals, (q0+i)*6, (size_t)j*(n+1)+i, n);
+      if (db->dtc != NULL)
+        for (i=0;i<(int)nQuads;i++)
+          DISJOINT_QUAD_COPY(db->dtc, db->baseTCs, (q0+i)*6, (size_t)j*(n+1)+i, n);
+    }
+}
+
+void
+buildDisjointTriangleArrays(MeshArena *arena,
+                            int nVertsPerAxis,
+                            int triangleLimit,
+                            int meshStreams,
+                            int nThreads,
+                            int *dispatchTriangles,
+                            int *dispatchVertexCount,
+                            Vertex2D *baseVerts,
+                            Color3D *baseColors,
+                            Vertex3D *baseNormals,
+                            Vertex2D *baseTCs,
+                            Vertex2D **dispatchVerts,
+                            Color3D **dispatchColors,
+                            Vertex3D **dispatchNormals,
+                            Vertex2D **dispatchTCs)
+{
+
+  /* now, create and populate the arrays that will be used to dispatch
+     triangle data off to OpenGL */
+
+  DisjointBuild db;
+  size_t nTris = (size_t)nVertsPerAxis*nVertsPerAxis*2;
+  size_t nVerts;
+  int nRows;
+
+  /*
+   * how many do we actually send down with each call? Only that many
+   * get built; rounding up to whole quads keeps the row kernel simple.
+   */
+  if (nTris > (size_t)triangleLimit)
+    nTris = triangleLimit;
+  nVerts = ((nTris + 1)/2)*6;
+  nRows = nVertsPerAxis ? (int)(((nTris + 1)/2 + nVertsPerAxis - 1)/nVertsPerAxis) : 0;
+
+  db.nVertsPerAxis = nVertsPerAxis;
+  db.nTriangles = nTris;
+  db.baseVerts = baseVerts;
+  db.baseColors = baseColors;
+  db.baseNormals = baseNormals;
+  db.baseTCs = baseTCs;
+  db.dv = *dispatchVerts = (Vertex2D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex2D), "disjoint vertices");
+  db.dc = *dispatchColors = (Color3D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Color3D), "disjoint colors");
+  db.dn = *dispatchNormals = (meshStreams & MESH_STREAM_NORMALS) ? (Vertex3D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex3D), "disjoint normals") : NULL;
+  db.dtc = *dispatchTCs = (meshStreams & MESH_STREAM_TCS) ? (Vertex2D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex2D), "disjoint texcoords") : NULL;
+
+  wesParallelFor(nThreads, nRows, (size_t)nVertsPerAxis*6, buildDisjointRows, &db);
+
+  *dispatchTriangles = (int)nTris;
+  *dispatchVertexCount = (int)nTris*3;
+}
+
+/*
+ * Visit the mesh as row-by-row triangle strips, stitching adjacent rows
+ * together with two repeated vertices (four degenerate triangles).  Each
+ * row emits (0,j+1),(0,j),(1,j+1),(1,j),... so every row has an even
+ * number of vertices and the winding stays consistent across stitches.
+ * The callback receives the base-mesh index of each strip vertex in
+ * order; the return value is the number of strip vertices visited, and
+ * *nTriangles receives the count of non-degenerate triangles.
+ */
+static size_t
+visitTriangleStrips(int nVertsPerAxis,
+                    size_t triangleLimit,
+                    size_t *nTriangles,
+                    void (*emit)(void *, size_t, GLuint),
+                    void *emitData)
+{
+  size_t n = 0, k, tris = 0, rowLen = nVertsPerAxis+1;
+  int j;
+
+  for (j=0;j<nVertsPerAxis && tris<triangleLimit;j++)
+    {
+      size_t rowTris = 2*(size_t)nVertsPerAxis;
+
+      if (tris + rowTris > triangleLimit)
+        rowTris = triangleLimit - tris;
+
+      /* degenerate stitch: repeat the first vert of this row */
+      if (j > 0)
+        emit(emitData, n++, (GLuint)((j+1)*rowLen));
+
+      for (k=0;k<rowTris+2;k++)
+        {
+          size_t i = k >> 1;
+          if ((k & 1) == 0)
+            emit(emitData, n++, (GLuint)((j+1)*rowLen + i));
+          else
+            emit(emitData, n++, (GLuint)(j*rowLen + i));
+        }
+      tris += rowTris;
+
+      /* ... and the last vert of this row, if another row follows */
+      if (j+1 < nVertsPerAxis && tris < triangleLimit)
+        emit(emitData, n++, (GLuint)(j*rowLen + nVertsPerAxis));
+    }
+
+  *nTriangles = tris;
+  return n;
+}
+
+typedef struct
+{
+  Vertex2D *baseVerts, *dv;
+  Color3D *baseColors, *dc;
+  Vertex3D *baseNormals, *dn;
+  Vertex2D *baseTCs, *dtc;
+} StripCopy;
+
+static void
+emitStripVertex(void *data, size_t n, GLuint sIndx)
+{
+  StripCopy *sc = (StripCopy *)data;
+  sc->dv[n] = sc->baseVerts[sIndx];
+  sc->dc[n] = sc->baseColors[sIndx];
+  if (sc->dn != NULL)
+    sc->dn[n] = sc->baseNormals[sIndx];
+  if (sc->dtc != NULL)
+    sc->dtc[n] = sc->baseTCs[sIndx];
+}
+
+static void
+countStripVertex(void *data, size_t n, GLuint sIndx)
+{
+  (void)data;
+  (void)n;
+  (void)sIndx;
+}
+
+void
+buildTriangleStripArrays(MeshArena *arena,
+                         int nVertsPerAxis,
+                         int triangleLimit,
+                         int meshStreams,
+                         int *dispatchTriangles,
+                         int *dispatchVertexCount,
+                         Vertex2D *baseVerts,
+                         Color3D *baseColors,
+                         Vertex3D *baseNormals,
+                         Vertex2D *baseTCs,
+                         Vertex2D **dispatchVerts,
+                         Color3D **dispatchColors,
+                         Vertex3D **dispatchNormals,
+                         Vertex2D **dispatchTCs)
+{
+  /*
+   * one long GL_TRIANGLE_STRIP covering the mesh. Unlike the disjoint
+   * case, the limit is applied while building since the strip can't
+   * just be truncated at an arbitrary vertex count.
+   */
+  StripCopy sc;
+  size_t nTris, nVerts;
+
+  nVerts = visitTriangleStrips(nVertsPerAxis, triangleLimit, &nTris,
+                               countStripVertex, NULL);
+
+  sc.baseVerts = baseVerts;
+  sc.baseColors = baseColors;
+  sc.baseNormals = baseNormals;
+  sc.baseTCs = baseTCs;
+  sc.dv = *dispatchVerts = (Vertex2D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex2D), "strip vertices");
+  sc.dc = *dispatchColors = (Color3D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Color3D), "strip colors");
+  sc.dn = *dispatchNormals = (meshStreams & MESH_STREAM_NORMALS) ? (Vertex3D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex3D), "strip normals") : NULL;
+  sc.dtc = *dispatchTCs = (meshStreams & MESH_STREAM_TCS) ? (Vertex2D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex2D), "strip texcoords") : NULL;
+
+  visitTriangleStrips(nVertsPerAxis, triangleLimit, &nTris,
+                      emitStripVertex, &sc);
+
+  *dispatchTriangles = (int)nTris;
+  *dispatchVertexCount = (int)nVerts;
+}
+
+typedef struct
+{
+  void *indices;
+  GLenum indexType;
+} IndexStore;
+
+static void
+storeIndex(void *data, size_t n, GLuint v)
+{
+  IndexStore *is = (IndexStore *)data;
+  if (is->indexType == GL_UNSIGNED_SHORT)
+    ((GLushort *)is->indices)[n] = (GLushort)v;
+  else
+    ((GLuint *)is->indices)[n] = v;
+}
+
+void
+buildIndexedTriangleArrays(MeshArena *arena,
+                           int nVertsPerAxis,
+                           int triangleLimit,
+                           int useStrips,
+                           int indexBits,
+                           int *dispatchTriangles,
+                           int *dispatchIndexCount,
+                           GLenum *dispatchIndexType,
+                           void **dispatchIndices)
+{
+  /*
+   * indexed variants draw straight out of the base arrays, so only the
+   * index list is built here. 16 bit indices are used when every base
+   * vertex is addressable with them, unless -it says otherwise.
+   */
+  size_t nBaseVerts = (size_t)(nVertsPerAxis+1)*(nVertsPerAxis+1);
+  size_t nTris, nIndices;
+  IndexStore is;
+
+  if (indexBits == 0)
+    indexBits = (nBaseVerts <= 65536) ? 16 : 32;
+  else if (indexBits == 16 && nBaseVerts > 65536)
+    {
+      fprintf(stderr," %zu mesh vertices don't fit 16 bit indices, using 32 bit. \n", nBaseVerts);
+      indexBits = 32;
+    }
+  is.indexType = (indexBits == 16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+  if (useStrips)
+    {
+      nIndices = visitTriangleStrips(nVertsPerAxis, triangleLimit, &nTris,
+                                     countStripVertex, NULL);
+      is.indices = arenaAllocOrDie(arena, nIndices, indexBits/8, "indices");
+      visitTriangleStrips(nVertsPerAxis, triangleLimit, &nTris,
+                          storeIndex, &is);
+    }
+  else
+    {
+      int i, j;
+      size_t sIndx, dIndx = 0;
+
+      nTris = (size_t)nVertsPerAxis*nVertsPerAxis*2;
+      if (nTris > (size_t)triangleLimit)
+        nTris = triangleLimit;
+      nIndices = nTris*3;
+      is.indices = arenaAllocOrDie(arena, nIndices, indexBits/8, "indices");
+
+      /* same two triangles per quad as buildDisjointTriangleArrays */
+      for (j=0;j<nVertsPerAxis && dIndx<nIndices;j++)
+        {
+          for (i=0;i<nVertsPerAxis && dIndx<nIndices;i++)
+            {
+              sIndx = (size_t)j*(nVertsPerAxis+1) + i;
+
+              storeIndex(&is, dIndx++, sIndx);
+              storeIndex(&is, dIndx++, sIndx+1);
+              storeIndex(&is, dIndx++, sIndx+nVertsPerAxis+1);
+              if (dIndx == nIndices)
+                break;
+
+              storeIndex(&is, dIndx++, sIndx+nVertsPerAxis+1);
+              storeIndex(&is, dIndx++, sIndx+1);
+              storeIndex(&is, dIndx++, sIndx+1+nVertsPerAxis+1);
+            }
+        }
+    }
+
+  *dispatchTriangles = (int)nTris;
+  *dispatchIndexCount = (int)nIndices;
+  *dispatchIndexType = is.indexType;
+  *dispatchIndices = is.indices;
+}
+
+/*
+ * Estimate how many vertices the GPU actually has to transform per frame
+ * by running the index stream through a POST_TRANSFORM_CACHE_SIZE entry
+ * FIFO cache. Non-indexed submissions get no reuse at all, so every
+ * submitted vertex is a miss.
+ */
+size_t
+countTransformedVertices(const void *indices,
+                         GLenum indexType,
+                         size_t nIndices,
+                         size_t nVerts)
+{
+  size_t *stamp, k, misses = 0;
+
+  if (indices == NULL)
+    return nIndices;
+
+  /* stamp[v] is 1 + the miss count at which v entered the cache */
+  stamp = (size_t *)calloc(nVerts, sizeof(size_t));
+  if (stamp == NULL)
+    {
+      fprintf(stderr, "Error: out of memory modelling the post-transform cache\n");
+      exit(1);
+    }
+  for (k=0;k<nIndices;k++)
+    {
+      GLuint v = (indexType == GL_UNSIGNED_SHORT) ?
+        ((const GLushort *)indices)[k] : ((const GLuint *)indices)[k];
+
+      /* misses - stamp[v] entries have gone in since v did */
+      if (stamp[v] == 0 || misses - stamp[v] >= POST_TRANSFORM_CACHE_SIZE)
+        {
+          misses++;
+          stamp[v] = misses;
+        }
+    }
+  free(stamp);
+  return misses;
+}
+
+
+/*
+ * Rows of the base mesh are independent, so they're generated in
+ * parallel. Every attribute is computed from the (i,j) grid position
+ * rather than accumulated, which lets the inner loops vectorize.
+ */
+typedef struct
+{
+  int nVertsPerAxis;
+  float x0, y0, spacing, step;
+  float nx0, ny0, nz;         /* normal = normalize(pos - center, nz) */
+  Vertex2D *bv, *btc;
+  Color3D *bc;
+  Vertex3D *bn;
+} BaseBuild;
+
+static void
+buildBaseRows(void *ctx, int rowBegin, int rowEnd)
+{
+  const BaseBuild *bb = (const BaseBuild *)ctx;
+  int rowLen = bb->nVertsPerAxis+1;
+  int i, j;
+
+  for (j=rowBegin;j<rowEnd;j++)
+    {
+      float y = bb->y0 + j*bb->spacing;
+      float g = j*bb->step;
+      Vertex2D *restrict bv = bb->bv + (size_t)j*rowLen;
+      Color3D *restrict bc = bb->bc + (size_t)j*rowLen;
+
+      for (i=0;i<rowLen;i++)
+        {
+          bv[i].x = bb->x0 + i*bb->spacing;
+          bv[i].y = y;
+        }
+
+      /* red grows along x axis, green along y axis, b=1 constant */
+      for (i=0;i<rowLen;i++)
+        {
+          bc[i].r = i*bb->step;
+          bc[i].g = g;
+          bc[i].b = 1.0F;
+        }
+
+      if (bb->bn != NULL)
+        {
+          Vertex3D *restrict bn = bb->bn + (size_t)j*rowLen;
+          float ny = y - bb->ny0;
+
+          for (i=0;i<rowLen;i++)
+            {
+              float nx = bb->x0 + i*bb->spacing - bb->nx0;
+              float d2 = nx*nx + ny*ny + bb->nz*bb->nz;
+              float inv = (d2 != 0.0F) ? 1.0F/sqrtf(d2) : 0.0F;
+              bn[i].x = nx*inv;
+              bn[i].y = ny*inv;
+              bn[i].z = bb->nz*inv;
+            }
+        }
+
+      if (bb->btc != NULL)
+        {
+          Vertex2D *restrict btc = bb->btc + (size_t)j*rowLen;
+
+          for (i=0;i<rowLen;i++)
+            {
+              btc[i].x = i*bb->step;
+              btc[i].y = g;
+            }
+        }
+    }
+}
+
+/* fills in the grid parameters of bb and returns nVertsPerAxis */
+static int
+baseMeshGrid(BaseBuild *bb,
+             float triangleAreaPixels,
+             int screenWidth,
+             int screenHeight)
+{
+  int usablePixels = (screenWidth < screenHeight ? screenWidth : screenHeight) >> 1;
+
+  /*
+   * we're going to construct a mesh that has vertex spacing
+   * at an interval such that each mesh quad will have two
+   * triangles whose area sums to triangleAreaPixels*2.
+   */
+  double spacing = sqrt(triangleAreaPixels*2.0);
+
+  memset(bb, 0, sizeof(*bb));
+  bb->nVertsPerAxis = (int)((double)usablePixels/spacing);
+  bb->spacing = (float)spacing;
+  bb->step = 1.0F/(float)bb->nVertsPerAxis;
+  bb->x0 = 0.5F * (screenWidth - usablePixels);
+  bb->y0 = 0.5F * (screenHeight - usablePixels);
+  bb->nx0 = (float)screenWidth*0.5F;
+  bb->ny0 = (float)screenHeight*0.5F;
+  bb->nz = (float)(screenWidth+screenHeight)*.25F;
+  return bb->nVertsPerAxis;
+}
+
+void
+buildBaseArrays(MeshArena *arena,
+                float triangleAreaPixels,
+                int screenWidth,
+                int screenHeight,
+                int meshStreams,
+                int nThreads,
+                int *nVertsPerAxis,
+                Vertex2D **baseVerts,
+                Color3D **baseColors,
+                Vertex3D **baseNormals,
+                Vertex2D **baseTCs)
+{
+  /* construct base arrays for qmesh */
+
+  size_t nVerts;
+  BaseBuild bb;
+
+  *nVertsPerAxis = baseMeshGrid(&bb, triangleAreaPixels, screenWidth, screenHeight);
+  nVerts = (size_t)(*nVertsPerAxis+1)*(*nVertsPerAxis+1);
+
+  /* normals and texture coordinates only when something binds them */
+  bb.bv = *baseVerts = (Vertex2D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex2D), "base vertices");
+  bb.bc = *baseColors = (Color3D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Color3D), "base colors");
+  bb.bn = *baseNormals = (meshStreams & MESH_STREAM_NORMALS) ? (Vertex3D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex3D), "base normals") : NULL;
+  bb.btc = *baseTCs = (meshStreams & MESH_STREAM_TCS) ? (Vertex2D *)
+    arenaAllocOrDie(arena, nVerts, sizeof(Vertex2D), "base texcoords") : NULL;
+
+  wesParallelFor(nThreads, *nVertsPerAxis+1, (size_t)*nVertsPerAxis+1,
+                 buildBaseRows, &bb);
+}
+
+/*
+ * Wall clock in seconds. Doesn't go through GLFW so that it also works
+ * when -headless never initializes it.
+ */
+static double
+wesGetTime(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart/(double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec*1.0e-9;
+#endif
+}
+
+
+/*
+ * Per-frame timing. Every frame's CPU time is kept as a sample, and when
+ * timer queries are available each frame's draws are also bracketed with
+ * a GL_TIME_ELAPSED query. Queries live in a small ring and results are
+ * only collected once GL says they're available, so reading them back
+ * doesn't drain the pipeline; only a full ring forces a wait.
+ */
+typedef struct
+{
+  double *v;
+  size_t n, cap;
+} SampleArray;
+
+static void
+sampleArrayPush(SampleArray *sa, double x)
+{
+  if (sa->n == sa->cap)
+    {
+      double *v;
+
+      sa->cap = sa->cap ? sa->cap*2 : 1024;
+      v = (double *)realloc(sa->v, sizeof(double)*sa->cap);
+      if (v == NULL)
+        {
+          fprintf(stderr, "Error: out of memory recording %zu samples\n", sa->cap);
+          exit(1);
+        }
+      sa->v = v;
+    }
+  sa->v[sa->n++] = x;
+}
+
+static void
+sampleArrayFree(SampleArray *sa)
+{
+  free(sa->v);
+  sa->v = NULL;
+  sa->n = sa->cap = 0;
+}
+
+static int
+compareDoubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* fills p[0..3] with p50, p90, p99 and max; sorts the samples in place */
+static void
+samplePercentiles(SampleArray *sa, double p[4])
+{
+  static const double q[3] = {0.50, 0.90, 0.99};
+  int k;
+
+  p[0] = p[1] = p[2] = p[3] = 0.0;
+  if (sa->n == 0)
+    return;
+  qsort(sa->v, sa->n, sizeof(double), compareDoubles);
+  for (k=0;k<3;k++)
+    {
+      size_t r = (size_t)ceil(q[k]*sa->n); /* nearest rank */
+      p[k] = sa->v[r > 0 ? r-1 : 0];
+    }
+  p[3] = sa->v[sa->n-1];
+}
+
+/* log2 histogram of millisecond samples, one bucket per power of two us */
+static void
+printSampleHistogram(const char *label, const SampleArray *sa)
+{
+  size_t counts[FRAME_HISTOGRAM_BUCKETS], maxCount = 0, k;
+  int b, lo = FRAME_HISTOGRAM_BUCKETS, hi = -1;
+
+  memset(counts, 0, sizeof(counts));
+  for (k=0;k<sa->n;k++)
+    {
+      double us = sa->v[k]*1000.0;
+      b = (us < 1.0) ? 0 : (int)floor(log2(us)) + 1;
+      if (b >= FRAME_HISTOGRAM_BUCKETS)
+        b = FRAME_HISTOGRAM_BUCKETS-1;
+      counts[b]++;
+    }
+  for (b=0;b<FRAME_HISTOGRAM_BUCKETS;b++)
+    if (counts[b] != 0)
+      {
+        if (b < lo) lo = b;
+        hi = b;
+        if (counts[b] > maxCount) maxCount = counts[b];
+      }
+
+  printf("%s frame time histogram (us):\n", label);
+  for (b=lo;b<=hi;b++)
+    {
+      int bar = (int)((40*counts[b] + maxCount-1)/maxCount);
+      printf("  [%8.0f, %8.0f) %-40.*s %zu\n",
+             b == 0 ? 0.0 : ldexp(1.0, b-1), ldexp(1.0, b),
+             bar, "########################################", counts[b]);
+    }
+}
+
+typedef struct
+{
+  GLenum target;              /* GL_TIME_ELAPSED, GL_SAMPLES_PASSED, ... */
+  GLuint ids[QUERY_RING_SIZE];
+  int    head, count;         /* oldest outstanding query, number outstanding */
+  size_t stalls;              /* times a full ring made us wait on a result */
+  SampleArray *results;       /* retired results, in issue order */
+} QueryRing;
+
+static void
+queryRingInit(QueryRing *qr, GLenum target, SampleArray *results)
+{
+  memset(qr, 0, sizeof(*qr));
+  qr->target = target;
+  qr->results = results;
+  glGenQueries(QUERY_RING_SIZE, qr->ids);
+}
+
+/* collect finished results, oldest first; with wait != 0, collect them all */
+static void
+queryRingRetire(QueryRing *qr, int wait)
+{
+  while (qr->count > 0)
+    {
+      GLuint id = qr->ids[qr->head];
+      GLuint64 result;
+
+      if (!wait)
+        {
+          GLint available = 0;
+          glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &available);
+          if (!available)
+            break;
+        }
+      glGetQueryObjectui64v(id, GL_QUERY_RESULT, &result);
+      sampleArrayPush(qr->results, (double)result);
+      qr->head = (qr->head + 1) % QUERY_RING_SIZE;
+      qr->count--;
+    }
+}
+
+static void
+queryRingBegin(QueryRing *qr)
+{
+  if (qr->count == QUERY_RING_SIZE)
+    {
+      queryRingRetire(qr, 0);
+      if (qr->count == QUERY_RING_SIZE)
+        {
+          /* GPU is more than a ring behind, nothing for it but to wait */
+          GLuint id = qr->ids[qr->head];
+          GLuint64 result;
+          glGetQueryObjectui64v(id, GL_QUERY_RESULT, &result);
+          sampleArrayPush(qr->results, (double)result);
+          qr->head = (qr->head + 1) % QUERY_RING_SIZE;
+          qr->count--;
+          qr->stalls++;
+        }
+    }
+  glBeginQuery(qr->target, qr->ids[(qr->head + qr->count) % QUERY_RING_SIZE]);
+}
+
+static void
+queryRingEnd(QueryRing *qr)
+{
+  glEndQuery(qr->target);
+  qr->count++;
+}
+
+static void
+queryRingDestroy(QueryRing *qr)
+{
+  queryRingRetire(qr, 1);
+  glDeleteQueries(QUERY_RING_SIZE, qr->ids);
+}
+
+/* float to IEEE half, round to nearest even; no NaN handling needed here */
+static GLushort
+floatToHalf(float f)
+{
+  union { float f; unsigned int u; } v;
+  unsigned int sign, mant;
+  int exp;
+
+  v.f = f;
+  sign = (v.u >> 16) & 0x8000;
+  exp = (int)((v.u >> 23) & 0xff) - 127 + 15;
+  mant = v.u & 0x7fffff;
+
+  if (exp >= 31)
+    return (GLushort)(sign | 0x7c00);
+  if (exp <= 0)
+    {
+      if (exp < -10)
+        return (GLushort)sign;
+      mant |= 0x800000;
+      mant = (mant >> (1 - exp)) + ((mant >> (-exp)) & 1); /* round */
+      return (GLushort)(sign | ((mant + 0xfff) >> 13));
+    }
+  mant = mant + 0xfff + ((mant >> 13) & 1);
+  if (mant & 0x800000)
+    {
+      mant = 0;
+      exp++;
+      if (exp >= 31)
+        return (GLushort)(sign | 0x7c00);
+    }
+  return (GLushort)(sign | (exp << 10) | (mant >> 13));
+}
+
+static int
+vertexFormatSupported(PositionFormat pf, ColorFormat cf)
+{
+  if ((pf == POS_HALF || cf == COLOR_HALF) &&
+      !(GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex))
+    return 0;
+  if (cf == COLOR_INT_2_10_10_10 &&
+      !(GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev))
+    return 0;
+  return 1;
+}
+
+static void
+encodePosition(unsigned char *dst, PositionFormat pf, Vertex2D v, float scale)
+{
+  switch (pf)
+    {
+    case POS_HALF:
+      ((GLushort *)dst)[0] = floatToHalf(v.x);
+      ((GLushort *)dst)[1] = floatToHalf(v.y);
+      break;
+    case POS_SHORT:
+      ((GLshort *)dst)[0] = (GLshort)lrintf(v.x*scale);
+      ((GLshort *)dst)[1] = (GLshort)lrintf(v.y*scale);
+      break;
+    default:
+      *(Vertex2D *)dst = v;
+      break;
+    }
+}
+
+static void
+encodeColor(unsigned char *dst, ColorFormat cf, Color3D c)
+{
+  switch (cf)
+    {
+    case COLOR_HALF:
+      ((GLushort *)dst)[0] = floatToHalf(c.r);
+      ((GLushort *)dst)[1] = floatToHalf(c.g);
+      ((GLushort *)dst)[2] = floatToHalf(c.b);
+      ((GLushort *)dst)[3] = floatToHalf(1.0F);
+      break;
+    case COLOR_SHORT:
+      ((GLshort *)dst)[0] = (GLshort)lrintf(c.r*32767.0F);
+      ((GLshort *)dst)[1] = (GLshort)lrintf(c.g*32767.0F);
+      ((GLshort *)dst)[2] = (GLshort)lrintf(c.b*32767.0F);
+      ((GLshort *)dst)[3] = 32767;
+      break;
+    case COLOR_UBYTE:
+      {
+        Color4DUbyte *u = (Color4DUbyte *)dst;
+        u->r = (unsigned char)lrintf(c.r*255.0F);
+        u->g = (unsigned char)lrintf(c.g*255.0F);
+        u->b = (unsigned char)lrintf(c.b*255.0F);
+        u->a = 255;
+      }
+      break;
+    case COLOR_INT_2_10_10_10:
+      /* signed normalized: 511 is 1.0 for rgb, 1 is 1.0 for the 2 bit alpha */
+      *(GLuint *)dst = ((GLuint)lrintf(c.r*511.0F) & 0x3ff) |
+        (((GLuint)lrintf(c.g*511.0F) & 0x3ff) << 10) |
+        (((GLuint)lrintf(c.b*511.0F) & 0x3ff) << 20) |
+        (1u << 30);
+      break;
+    default:
+      *(Color3D *)dst = c;
+      break;
+    }
+}
+
+/*
+ * Encode the float dispatch arrays into the requested format and layout.
+ * The default (float, separate arrays) just points at the existing arrays.
+ */
+void
+buildVertexLayout(MeshArena *arena,
+                  VertexLayout *vl,
+                  PositionFormat pf,
+                  ColorFormat cf,
+                  int interleaved,
+                  const Vertex2D *verts,
+                  const Color3D *colors,
+                  int vertexCount,
+                  int screenWidth,
+                  int screenHeight)
+{
+  GLsizei pBytes = positionFormats[pf].bytes, cBytes = colorFormats[cf].bytes;
+  int maxSide = screenWidth > screenHeight ? screenWidth : screenHeight;
+  int v;
+
+  memset(vl, 0, sizeof(*vl));
+  vl->pf = pf;
+  vl->cf = cf;
+  vl->interleaved = interleaved;
+
+  /* largest power of two that keeps every coordinate within a GLshort */
+  vl->positionScale = 1.0F;
+  while (vl->positionScale*2.0F*maxSide <= 32767.0F)
+    vl->positionScale *= 2.0F;
+
+  if (pf == POS_FLOAT && cf == COLOR_FLOAT && !interleaved)
+    {
+      vl->nStreams = 2;
+      vl->streams[0] = (void *)verts;
+      vl->streams[1] = (void *)colors;
+      vl->streamBytes[0] = (size_t)pBytes*vertexCount;
+      vl->streamBytes[1] = (size_t)cBytes*vertexCount;
+      vl->stride[0] = pBytes;
+      vl->stride[1] = cBytes;
+      vl->colorStream = 1;
+      return;
+    }
+
+  if (interleaved)
+    {
+      unsigned char *dst;
+
+      vl->nStreams = 1;
+      vl->stride[0] = vl->stride[1] = pBytes + cBytes;
+      vl->offset[1] = pBytes;
+      vl->colorStream = 0;
+      vl->streamBytes[0] = (size_t)(pBytes + cBytes)*vertexCount;
+      dst = (unsigned char *)arenaAllocOrDie(arena, vl->streamBytes[0], 1,
+                                             "interleaved vertices");
+      vl->streams[0] = dst;
+      for (v=0;v<vertexCount;v++, dst+=pBytes+cBytes)
+        {
+          encodePosition(dst, pf, verts[v], vl->positionScale);
+          encodeColor(dst+pBytes, cf, colors[v]);
+        }
+    }
+  else
+    {
+      unsigned char *p, *c;
+
+      vl->nStreams = 2;
+      vl->stride[0] = pBytes;
+      vl->stride[1] = cBytes;
+      vl->colorStream = 1;
+      vl->streamBytes[0] = (size_t)pBytes*vertexCount;
+      vl->streamBytes[1] = (size_t)cBytes*vertexCount;
+      p = (unsigned char *)arenaAllocOrDie(arena, vl->streamBytes[0], 1, "encoded positions");
+      c = (unsigned char *)arenaAllocOrDie(arena, vl->streamBytes[1], 1, "encoded colors");
+      vl->streams[0] = p;
+      vl->streams[1] = c;
+      for (v=0;v<vertexCount;v++, p+=pBytes, c+=cBytes)
+        {
+          encodePosition(p, pf, verts[v], vl->positionScale);
+          encodeColor(c, cf, colors[v]);
+        }
+    }
+}
+
+/*
+ * The position and color arrays: fixed-function, or with -core (and
+ * -attribs, whose shader names every input) generic attributes 0 and 1.
+ * Integer colors are normalized like glColorPointer does.
+ */
+static int
+genericArrays(void)
+{
+  return myAppState.coreProfile || myAppState.fetchAttribs > 0 || myAppState.texMode;
+}
+
+static void
+positionPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+  if (genericArrays())
+    glVertexAttribPointer(0, size, type, GL_FALSE, stride, pointer);
+  else
+    glVertexPointer(size, type, stride, pointer);
+}
+
+static void
+colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+  if (genericArrays())
+    glVertexAttribPointer(1, size, type, type != GL_FLOAT && type != GL_HALF_FLOAT,
+                          stride, pointer);
+  else
+    glColorPointer(size, type, stride, pointer);
+}
+
+static void
+enableVertexArrays(int enable)
+{
+  if (genericArrays() && enable)
+    {
+      glEnableVertexAttribArray(0);
+      glEnableVertexAttribArray(1);
+    }
+  else if (genericArrays())
+    {
+      glDisableVertexAttribArray(0);
+      glDisableVertexAttribArray(1);
+    }
+  else if (enable)
+    {
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_COLOR_ARRAY);
+    }
+  else
+    {
+      glDisableClientState(GL_VERTEX_ARRAY);
+      glDisableClientState(GL_COLOR_ARRAY);
+    }
+}
+
+/* a float generic attribute from a buffer (or client memory when 0) */
+static void
+bindAttribArray(GLuint index, GLint size, GLsizei stride, const GLvoid *data,
+                GLuint buffer, int enable)
+{
+  if (!enable)
+    {
+      glDisableVertexAttribArray(index);
+      return;
+    }
+  if (buffer)
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, stride, data);
+  glEnableVertexAttribArray(index);
+  if (buffer)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* the float normals for -vert light=1: gl_Normal, or generic attribute 2 */
+static void
+bindNormals(const Vertex3D *normals, GLuint buffer, int enable)
+{
+  const GLvoid *pointer = buffer ? (const GLvoid *)0 : (const GLvoid *)normals;
+
+  if (genericArrays())
+    {
+      bindAttribArray(2, 3, sizeof(Vertex3D), pointer, buffer, enable);
+      return;
+    }
+  if (!enable)
+    {
+      glDisableClientState(GL_NORMAL_ARRAY);
+      return;
+    }
+  if (buffer)
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glNormalPointer(GL_FLOAT, sizeof(Vertex3D), pointer);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  if (buffer)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* point the vertex arrays at the layout: buffers holds the uploaded
+   streams with -retained, NULL means draw from client memory */
+static void
+bindVertexLayout(const VertexLayout *vl, const GLuint *buffers)
+{
+  const AttribFormat *p = &positionFormats[vl->pf], *c = &colorFormats[vl->cf];
+  const unsigned char *pBase = buffers ? NULL : (const unsigned char *)vl->streams[0];
+  const unsigned char *cBase = buffers ? NULL : (const unsigned char *)vl->streams[vl->colorStream];
+
+  if (buffers)
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+  positionPointer(p->size, p->type, vl->stride[0], (const GLvoid *)(pBase + vl->offset[0]));
+  if (buffers)
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[vl->colorStream]);
+  colorPointer(c->size, c->type, vl->stride[1], (const GLvoid *)(cBase + vl->offset[1]));
+  if (buffers)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+ * Geometry cache. Building a mesh can take longer than measuring it, and
+ * repeated trials, shader-only changes and revisited sweep points all ask
+ * for the same one, so finished meshes (and their buffer objects, once
+ * -retained uploads them) are kept, keyed by everything that shapes them.
+ * Entries are kept in LRU order and trimmed to the -cachemb budget after
+ * every run.
+ */
+typedef struct
+{
+  double area;
+  int width, height;
+  int triangleType;
+  size_t triangleLimit, vertexBufLimit;
+  int splitDraws;             /* -vl is a batch size rather than a cap */
+  int indexBits, meshStreams;
+  int positionFormat, colorFormat, interleaved;
+} MeshKey;
+
+typedef struct MeshEntry
+{
+  struct MeshEntry *newer, *older;
+  MeshKey key;
+  MeshArena arena;            /* every array below lives in here */
+  Vertex2D *dispatchVerts, *dispatchTCs;
+  Color3D  *dispatchColors;
+  Vertex3D *dispatchNormals;
+  void     *dispatchIndices;
+  GLenum   dispatchIndexType;  /* 0 means glDrawArrays */
+  GLenum   dispatchPrimitive;
+  int dispatchVertexCount, dispatchTriangles, dispatchIndexCount;
+  size_t vertsPerArrayCall, indicesPerArrayCall, transformedVerts;
+  VertexLayout layout;
+  GLuint buffers[5];          /* verts, colors, indices, normals, texcoords once uploaded */
+  GLenum bufferUsage;
+  size_t gpuBytes;
+  void  *fileMap;             /* arrays point in here when mapped from -gc */
+  size_t fileMapBytes;
+  double buildSeconds;
+} MeshEntry;
+
+static struct
+{
+  MeshEntry *newest, *oldest;
+  int nEntries;
+  size_t hits, misses;
+} meshCache;
+
+static void
+meshKeyFromState(const AppState *as, MeshKey *key)
+{
+  memset(key, 0, sizeof(*key)); /* keys are compared with memcmp */
+  key->area = as->triangleAreaInPixels;
+  key->width = as->imgWidth;
+  key->height = as->imgHeight;
+  key->triangleType = as->triangleType;
+  key->triangleLimit = as->triangleLimit;
+  key->vertexBufLimit = as->vertexBufLimit;
+  key->splitDraws = (as->submitMode != SUBMIT_SINGLE_DRAW);
+  key->indexBits = as->indexBits;
+  key->meshStreams = as->meshStreams;
+  key->positionFormat = as->positionFormat;
+  key->colorFormat = as->colorFormat;
+  key->interleaved = as->interleaved;
+}
+
+static size_t
+meshEntryBytes(const MeshEntry *e)
+{
+  return e->arena.inUse + e->fileMapBytes + e->gpuBytes;
+}
+
+static void
+meshCacheUnlink(MeshEntry *e)
+{
+  if (e->newer)
+    e->newer->older = e->older;
+  else
+    meshCache.newest = e->older;
+  if (e->older)
+    e->older->newer = e->newer;
+  else
+    meshCache.oldest = e->newer;
+  e->newer = e->older = NULL;
+  meshCache.nEntries--;
+}
+
+static void
+meshCachePushNewest(MeshEntry *e)
+{
+  e->older = meshCache.newest;
+  e->newer = NULL;
+  if (meshCache.newest)
+    meshCache.newest->newer = e;
+  else
+    meshCache.oldest = e;
+  meshCache.newest = e;
+  meshCache.nEntries++;
+}
+
+static size_t
+meshCacheBytes(void)
+{
+  MeshEntry *e;
+  size_t bytes = 0;
+
+  for (e=meshCache.newest;e!=NULL;e=e->older)
+    bytes += meshEntryBytes(e);
+  return bytes;
+}
+
+/* evict least recently used meshes until the rest fit the budget */
+static void
+meshCacheTrim(size_t budgetBytes)
+{
+  while (meshCache.oldest != NULL && meshCacheBytes() > budgetBytes)
+    {
+      MeshEntry *e = meshCache.oldest;
+
+      meshCacheUnlink(e);
+      if (e->buffers[0] != 0)
+        glDeleteBuffers(5, e->buffers);
+#ifndef _WIN32
+      if (e->fileMap != NULL)
+        munmap(e->fileMap, e->fileMapBytes);
+#endif
+      arenaRelease(&e->arena);
+      free(e);
+    }
+}
+
+static MeshEntry *
+buildMeshEntry(AppState *as)
+{
+  MeshEntry *e = (MeshEntry *)calloc(1, sizeof(MeshEntry));
+  Vertex2D *baseVerts;
+  Color3D *baseColors;
+  Vertex3D *baseNormals;
+  Vertex2D *baseTCs;
+  int nVertsPerAxis;
+  double t0 = wesGetTime();
+
+  if (e == NULL)
+    {
+      fprintf(stderr, "Error: out of memory allocating a mesh cache entry\n");
+      exit(1);
+    }
+  meshKeyFromState(as, &e->key);
+  e->arena.lockPages = as->lockMeshPages;
+  e->dispatchPrimitive = GL_TRIANGLES;
+
+  /* encode the streams in the requested vertex format */
+  if (!vertexFormatSupported(as->positionFormat, as->colorFormat))
+    {
+      fprintf(stderr, "Error: vertex format %s/%s isn't supported by this GL\n",
+              positionFormats[as->positionFormat].name,
+              colorFormats[as->colorFormat].name);
+      exit(1);
+    }
+  /* build the base quadmesh vertex array */
+  buildBaseArrays(&e->arena, as->triangleAreaInPixels, as->imgWidth, as->imgHeight,
+                  as->meshStreams, as->meshThreads,
+                  &nVertsPerAxis,
+                  &baseVerts, &baseColors, &baseNormals, &baseTCs);
+
+  /* now, repackage that information into bundles suitable for submission
+     to GL using the specified primitive type*/
+  if (as->triangleType == DISJOINT_TRIANGLES)
+    {
+      int triangleLimit;
+
+      /* when splitting into draws, -vl is the batch size, not a cap */
+      if ((as->triangleLimit*3) > as->vertexBufLimit &&
+          as->submitMode == SUBMIT_SINGLE_DRAW)
+        triangleLimit = as->vertexBufLimit/3;
+      else
+        triangleLimit = as->triangleLimit;
+
+      buildDisjointTriangleArrays(&e->arena,
+                                  nVertsPerAxis,
+                                  triangleLimit,
+                                  as->meshStreams,
+                                  as->meshThreads,
+                                  &e->dispatchTriangles,
+                                  &e->dispatchVertexCount,
+                                  baseVerts, baseColors,
+                                  baseNormals, baseTCs,
+                                  &e->dispatchVerts,
+                                  &e->dispatchColors,
+                                  &e->dispatchNormals,
+                                  &e->dispatchTCs);
+      e->vertsPerArrayCall = e->dispatchVertexCount;
+      e->indicesPerArrayCall = 0;
+    }
+  else if (as->triangleType == TRIANGLE_STRIPS)
+    {
+      int triangleLimit;
+
+      /* a strip costs about one vertex per triangle (plus stitching) */
+      if (as->triangleLimit+2 > as->vertexBufLimit)
+        triangleLimit = as->vertexBufLimit-2;
+      else
+        triangleLimit = as->triangleLimit;
+
+      buildTriangleStripArrays(&e->arena,
+                               nVertsPerAxis,
+                               triangleLimit,
+                               as->meshStreams,
+                               &e->dispatchTriangles,
+                               &e->dispatchVertexCount,
+                               baseVerts, baseColors,
+                               baseNormals, baseTCs,
+                               &e->dispatchVerts,
+                               &e->dispatchColors,
+                               &e->dispatchNormals,
+                               &e->dispatchTCs);
+      e->dispatchPrimitive = GL_TRIANGLE_STRIP;
+      e->vertsPerArrayCall = e->dispatchVertexCount;
+      e->indicesPerArrayCall = 0;
+    }
+  else
+    {
+      int triangleLimit;
+      int useStrips = (as->triangleType == INDEXED_TRIANGLE_STRIPS);
+
+      /* here vertexBufLimit bounds the length of the index list */
+      triangleLimit = as->triangleLimit;
+      if (useStrips && as->triangleLimit+2 > as->vertexBufLimit)
+        triangleLimit = as->vertexBufLimit-2;
+      else if (!useStrips && as->triangleLimit*3 > as->vertexBufLimit)
+        triangleLimit = as->vertexBufLimit/3;
+
+      buildIndexedTriangleArrays(&e->arena,
+                                 nVertsPerAxis,
+                                 triangleLimit,
+                                 useStrips,
+                                 as->indexBits,
+                                 &e->dispatchTriangles,
+                                 &e->dispatchIndexCount,
+                                 &e->dispatchIndexType,
+                                 &e->dispatchIndices);
+
+      /* the base mesh is drawn directly, there are no dispatch copies */
+      e->dispatchVerts = baseVerts;
+      e->dispatchColors = baseColors;
+      e->dispatchNormals = baseNormals;
+      e->dispatchTCs = baseTCs;
+      e->dispatchVertexCount = (nVertsPerAxis+1)*(nVertsPerAxis+1);
+      e->dispatchPrimitive = useStrips ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+      e->vertsPerArrayCall = e->dispatchVertexCount;
+      e->indicesPerArrayCall = e->dispatchIndexCount;
+    }
+
+  e->transformedVerts =
+    countTransformedVertices(e->dispatchIndices, e->dispatchIndexType,
+                             e->dispatchIndexType ? e->dispatchIndexCount : e->dispatchVertexCount,
+                             e->dispatchVertexCount);
+
+  /* encode the streams in the requested vertex format */
+  buildVertexLayout(&e->arena, &e->layout, as->positionFormat, as->colorFormat,
+                    as->interleaved, e->dispatchVerts, e->dispatchColors,
+                    e->dispatchVertexCount, as->imgWidth, as->imgHeight);
+
+  e->buildSeconds = wesGetTime() - t0;
+  return e;
+}
+
+/*
+ * On-disk geometry cache (-gc dir). A finished mesh is written once as
+ * a header followed by page aligned streams, and later runs with the
+ * same MeshKey mmap the file and point the dispatch arrays (and the
+ * glBufferData sources) straight at the mapped pages, so a cold start
+ * costs page-in time rather than mesh generation. The header checksum
+ * covers the header itself, the key and the stream table, and the
+ * table must then agree with the counts, strides and file length before
+ * anything points into the file; the stream contents are trusted.
+ */
+enum
+  {
+    GEOM_STREAM_LAYOUT0,        /* the encoded VertexLayout streams */
+    GEOM_STREAM_LAYOUT1,
+    GEOM_STREAM_INDICES,
+    GEOM_STREAM_POSITIONS,      /* float positions, when not LAYOUT0 already */
+    GEOM_STREAM_NORMALS,        /* with MESH_STREAM_NORMALS */
+    GEOM_STREAM_COUNT
+  };
+
+typedef struct
+{
+  char     magic[8];          /* "WESGEOM" */
+  uint32_t version, headerBytes;
+  uint64_t checksum;          /* FNV-1a of the header with this zeroed */
+  uint64_t fileBytes;
+  MeshKey  key;
+  int32_t  dispatchVertexCount, dispatchTriangles, dispatchIndexCount;
+  uint32_t dispatchIndexType, dispatchPrimitive;
+  uint64_t vertsPerArrayCall, indicesPerArrayCall, transformedVerts;
+  int32_t  nStreams, colorStream, stride[2];
+  uint64_t layoutOffset[2];
+  float    positionScale;
+  uint64_t streamOffset[GEOM_STREAM_COUNT], streamBytes[GEOM_STREAM_COUNT];
+} GeomFileHeader;
+
+static uint64_t
+fnv1a64(const void *data, size_t n, uint64_t h)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  size_t k;
+
+  for (k=0;k<n;k++)
+    h = (h ^ p[k])*1099511628211ULL;
+  return h;
+}
+
+static uint64_t
+geomHeaderChecksum(const GeomFileHeader *hdr)
+{
+  GeomFileHeader h = *hdr;
+  h.checksum = 0;
+  return fnv1a64(&h, sizeof(h), 14695981039346656037ULL);
+}
+
+static void
+geomFileName(const char *dir, const MeshKey *key, char *path, size_t n)
+{
+  snprintf(path, n, "%s/wesbench-%016llx.geom", dir,
+           (unsigned long long)fnv1a64(key, sizeof(*key), 14695981039346656037ULL));
+}
+
+#ifndef _WIN32
+/* best effort: a mesh that can't be written is simply rebuilt next time */
+static void
+writeGeomFile(const char *dir, const MeshEntry *e)
+{
+  GeomFileHeader hdr;
+  const void *src[GEOM_STREAM_COUNT];
+  char path[4096], tmpPath[4200];
+  static const char zeros[GEOM_FILE_ALIGN];
+  uint64_t offset;
+  FILE *f;
+  int k, ok;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "WESGEOM", 8);
+  hdr.version = GEOM_FILE_VERSION;
+  hdr.headerBytes = sizeof(hdr);
+  hdr.key = e->key;
+  hdr.dispatchVertexCount = e->dispatchVertexCount;
+  hdr.dispatchTriangles = e->dispatchTriangles;
+  hdr.dispatchIndexCount = e->dispatchIndexCount;
+  hdr.dispatchIndexType = e->dispatchIndexType;
+  hdr.dispatchPrimitive = e->dispatchPrimitive;
+  hdr.vertsPerArrayCall = e->vertsPerArrayCall;
+  hdr.indicesPerArrayCall = e->indicesPerArrayCall;
+  hdr.transformedVerts = e->transformedVerts;
+  hdr.nStreams = e->layout.nStreams;
+  hdr.colorStream = e->layout.colorStream;
+  hdr.positionScale = e->layout.positionScale;
+  for (k=0;k<2;k++)
+    {
+      hdr.stride[k] = e->layout.stride[k];
+      hdr.layoutOffset[k] = e->layout.offset[k];
+    }
+
+  memset(src, 0, sizeof(src));
+  for (k=0;k<e->layout.nStreams;k++)
+    {
+      src[GEOM_STREAM_LAYOUT0+k] = e->layout.streams[k];
+      hdr.streamBytes[GEOM_STREAM_LAYOUT0+k] = e->layout.streamBytes[k];
+    }
+  if (e->dispatchIndexType != 0)
+    {
+      src[GEOM_STREAM_INDICES] = e->dispatchIndices;
+      hdr.streamBytes[GEOM_STREAM_INDICES] =
+        (e->dispatchIndexType == GL_UNSIGNED_SHORT ? 2 : 4)*(uint64_t)e->dispatchIndexCount;
+    }
+  if ((void *)e->dispatchVerts != e->layout.streams[0])
+    {
+      src[GEOM_STREAM_POSITIONS] = e->dispatchVerts;
+      hdr.streamBytes[GEOM_STREAM_POSITIONS] = sizeof(Vertex2D)*(uint64_t)e->dispatchVertexCount;
+    }
+  if (e->dispatchNormals != NULL)
+    {
+      src[GEOM_STREAM_NORMALS] = e->dispatchNormals;
+      hdr.streamBytes[GEOM_STREAM_NORMALS] = sizeof(Vertex3D)*(uint64_t)e->dispatchVertexCount;
+    }
+
+  offset = roundUpBytes(sizeof(hdr), GEOM_FILE_ALIGN);
+  for (k=0;k<GEOM_STREAM_COUNT;k++)
+    if (hdr.streamBytes[k] != 0)
+      {
+        hdr.streamOffset[k] = offset;
+        offset = roundUpBytes(offset + hdr.streamBytes[k], GEOM_FILE_ALIGN);
+      }
+  hdr.fileBytes = offset;
+  hdr.checksum = geomHeaderChecksum(&hdr);
+
+  /* write under a temporary name so readers never see a partial file */
+  geomFileName(dir, &e->key, path, sizeof(path));
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long)getpid());
+  f = fopen(tmpPath, "wb");
+  if (f == NULL)
+    {
+      fprintf(stderr, " Warning: can't write geometry cache file %s \n", tmpPath);
+      return;
+    }
+  ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+  offset = sizeof(hdr);
+  for (k=0;k<GEOM_STREAM_COUNT && ok;k++)
+    if (hdr.streamBytes[k] != 0)
+      {
+        ok = fwrite(zeros, 1, hdr.streamOffset[k] - offset, f) == hdr.streamOffset[k] - offset &&
+          fwrite(src[k], 1, hdr.streamBytes[k], f) == hdr.streamBytes[k];
+        offset = hdr.streamOffset[k] + hdr.streamBytes[k];
+      }
+  if (ok)
+    ok = fwrite(zeros, 1, hdr.fileBytes - offset, f) == hdr.fileBytes - offset;
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmpPath, path) != 0)
+    {
+      fprintf(stderr, " Warning: can't write geometry cache file %s \n", path);
+      unlink(tmpPath);
+    }
+}
+
+/* the stream table fits the file and the mesh the header describes */
+static int
+geomHeaderConsistent(const GeomFileHeader *hdr, const MeshKey *key)
+{
+  const AttribFormat *p = &positionFormats[key->positionFormat];
+  const AttribFormat *c = &colorFormats[key->colorFormat];
+  uint64_t verts = (uint64_t)hdr->dispatchVertexCount, bytes;
+  int k;
+
+  if (hdr->dispatchVertexCount <= 0 || hdr->dispatchIndexCount < 0 ||
+      hdr->dispatchTriangles < 0 ||
+      hdr->nStreams < 1 || hdr->nStreams > 2 ||
+      hdr->colorStream != hdr->nStreams - 1 ||
+      hdr->stride[0] <= 0 || hdr->stride[1] <= 0 ||
+      hdr->layoutOffset[0] + p->bytes > (uint64_t)hdr->stride[0] ||
+      hdr->layoutOffset[1] + c->bytes > (uint64_t)hdr->stride[1])
+    return 0;
+
+  for (k=0;k<GEOM_STREAM_COUNT;k++)
+    if (hdr->streamBytes[k] != 0 &&
+        (hdr->streamOffset[k] < sizeof(GeomFileHeader) ||
+         hdr->streamOffset[k] % GEOM_FILE_ALIGN != 0 ||
+         hdr->streamOffset[k] > hdr->fileBytes ||
+         hdr->streamBytes[k] > hdr->fileBytes - hdr->streamOffset[k]))
+      return 0;
+
+  /* each stream holds exactly what the counts say it should */
+  if (hdr->streamBytes[GEOM_STREAM_LAYOUT0] != (uint64_t)hdr->stride[0]*verts ||
+      hdr->streamBytes[GEOM_STREAM_LAYOUT1] !=
+      (hdr->nStreams == 2 ? (uint64_t)hdr->stride[1]*verts : 0))
+    return 0;
+  if (hdr->dispatchIndexType == 0)
+    bytes = 0;
+  else if (hdr->dispatchIndexType == GL_UNSIGNED_SHORT)
+    bytes = 2*(uint64_t)hdr->dispatchIndexCount;
+  else if (hdr->dispatchIndexType == GL_UNSIGNED_INT)
+    bytes = 4*(uint64_t)hdr->dispatchIndexCount;
+  else
+    return 0;
+  if (hdr->streamBytes[GEOM_STREAM_INDICES] != bytes)
+    return 0;
+  /* without a positions stream the float positions are layout stream 0 */
+  if (hdr->streamBytes[GEOM_STREAM_POSITIONS] == 0 ?
+      (key->positionFormat != POS_FLOAT || hdr->stride[0] != sizeof(Vertex2D)) :
+      hdr->streamBytes[GEOM_STREAM_POSITIONS] != sizeof(Vertex2D)*verts)
+    return 0;
+  if (hdr->streamBytes[GEOM_STREAM_NORMALS] !=
+      ((key->meshStreams & MESH_STREAM_NORMALS) ? sizeof(Vertex3D)*verts : 0))
+    return 0;
+  return 1;
+}
+
+/* NULL when there's no usable file for this key */
+static MeshEntry *
+loadGeomFile(const char *dir, const MeshKey *key)
+{
+  char path[4096];
+  struct stat st;
+  const GeomFileHeader *hdr;
+  unsigned char *map;
+  MeshEntry *e;
+  int fd, k;
+
+  geomFileName(dir, key, path, sizeof(path));
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(GeomFileHeader))
+    {
+      close(fd);
+      return NULL;
+    }
+  map = (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == (unsigned char *)MAP_FAILED)
+    return NULL;
+
+  hdr = (const GeomFileHeader *)map;
+  if (memcmp(hdr->magic, "WESGEOM", 8) != 0 ||
+      hdr->version != GEOM_FILE_VERSION ||
+      hdr->headerBytes != sizeof(GeomFileHeader) ||
+      hdr->checksum != geomHeaderChecksum(hdr) ||
+      hdr->fileBytes != (uint64_t)st.st_size ||
+      memcmp(&hdr->key, key, sizeof(*key)) != 0 ||
+      !geomHeaderConsistent(hdr, key))
+    {
+      fprintf(stderr, " Warning: ignoring stale or damaged geometry cache file %s \n", path);
+      munmap(map, st.st_size);
+      return NULL;
+    }
+#ifdef MADV_WILLNEED
+  madvise(map, st.st_size, MADV_WILLNEED); /* start the page-in now */
+#endif
+
+  e = (MeshEntry *)calloc(1, sizeof(MeshEntry));
+  if (e == NULL)
+    {
+      fprintf(stderr, "Error: out of memory allocating a mesh cache entry\n");
+      exit(1);
+    }
+  e->key = *key;
+  e->fileMap = map;
+  e->fileMapBytes = st.st_size;
+  e->dispatchVertexCount = hdr->dispatchVertexCount;
+  e->dispatchTriangles = hdr->dispatchTriangles;
+  e->dispatchIndexCount = hdr->dispatchIndexCount;
+  e->dispatchIndexType = hdr->dispatchIndexType;
+  e->dispatchPrimitive = hdr->dispatchPrimitive;
+  e->vertsPerArrayCall = hdr->vertsPerArrayCall;
+  e->indicesPerArrayCall = hdr->indicesPerArrayCall;
+  e->transformedVerts = hdr->transformedVerts;
+  e->layout.pf = (PositionFormat)key->positionFormat;
+  e->layout.cf = (ColorFormat)key->colorFormat;
+  e->layout.interleaved = key->interleaved;
+  e->layout.nStreams = hdr->nStreams;
+  e->layout.colorStream = hdr->colorStream;
+  e->layout.positionScale = hdr->positionScale;
+  for (k=0;k<hdr->nStreams;k++)
+    {
+      e->layout.streams[k] = map + hdr->streamOffset[GEOM_STREAM_LAYOUT0+k];
+      e->layout.streamBytes[k] = hdr->streamBytes[GEOM_STREAM_LAYOUT0+k];
+    }
+  for (k=0;k<2;k++)
+    {
+      e->layout.stride[k] = hdr->stride[k];
+      e->layout.offset[k] = hdr->layoutOffset[k];
+    }
+  if (hdr->streamBytes[GEOM_STREAM_INDICES] != 0)
+    e->dispatchIndices = map + hdr->streamOffset[GEOM_STREAM_INDICES];
+  e->dispatchVerts = hdr->streamBytes[GEOM_STREAM_POSITIONS] != 0 ?
+    (Vertex2D *)(map + hdr->streamOffset[GEOM_STREAM_POSITIONS]) :
+    (Vertex2D *)e->layout.streams[0];
+  if (hdr->streamBytes[GEOM_STREAM_NORMALS] != 0)
+    e->dispatchNormals = (Vertex3D *)(map + hdr->streamOffset[GEOM_STREAM_NORMALS]);
+  return e;
+}
+#endif
+
+/* the mesh for the current settings, built only on a cache miss */
+static MeshEntry *
+acquireMesh(AppState *as, const char **source)
+{
+  MeshKey key;
+  MeshEntry *e;
+
+  meshKeyFromState(as, &key);
+  for (e=meshCache.newest;e!=NULL;e=e->older)
+    if (memcmp(&e->key, &key, sizeof(key)) == 0)
+      break;
+
+  if (e != NULL)
+    {
+      meshCacheUnlink(e);
+      meshCache.hits++;
+      *source = "cache hit";
+    }
+  else
+    {
+      double t0 = wesGetTime();
+
+      meshCache.misses++;
+      e = NULL;
+#ifndef _WIN32
+      if (as->geomCacheDir != NULL && (as->meshStreams & ~MESH_STREAM_NORMALS) == 0)
+        e = loadGeomFile(as->geomCacheDir, &key);
+#endif
+      if (e != NULL)
+        {
+          e->buildSeconds = wesGetTime() - t0;
+          *source = "mapped from -gc file";
+        }
+      else
+        {
+          e = buildMeshEntry(as);
+          *source = "built";
+#ifndef _WIN32
+          /* the files hold the dispatch streams and normals, not texcoords */
+          if (as->geomCacheDir != NULL && (as->meshStreams & ~MESH_STREAM_NORMALS) == 0)
+            writeGeomFile(as->geomCacheDir, e);
+#endif
+        }
+    }
+  meshCachePushNewest(e);
+  return e;
+}
+
+/*
+ * Streaming dispatch (-stream). Instead of materializing the mesh, each
+ * frame's triangles are generated in chunks into a ring of
+ * STREAM_RING_CHUNKS slots in one persistently mapped buffer. A worker
+ * thread fills slot N+1 while GL draws slot N; a fence per slot tells
+ * the main thread when the GPU is done with it and the worker may
+ * overwrite it. Memory stays constant however many triangles a frame
+ * streams: past the end of the mesh the stream wraps around to its
+ * start.
+ */
+typedef struct
+{
+  float x, y, r, g, b;
+} StreamVertex;
+
+enum { STREAM_SLOT_FREE, STREAM_SLOT_FILLING, STREAM_SLOT_READY, STREAM_SLOT_INFLIGHT };
+
+typedef struct
+{
+  BaseBuild grid;             /* only the grid parameters, no arrays */
+  size_t meshTriangles, frameTriangles, chunkTriangles, chunksPerFrame;
+  GLuint buffer;
+  StreamVertex *mapped;
+  GLsync fences[STREAM_RING_CHUNKS];
+  volatile int state[STREAM_RING_CHUNKS];
+  size_t slotTriangles[STREAM_RING_CHUNKS];
+  size_t drawChunk;           /* next chunk the main thread draws */
+  double stallSeconds;        /* main thread waiting on fences or the worker */
+  double generateSeconds;     /* worker time spent writing vertices */
+  size_t bytesGenerated;
+#ifndef _WIN32
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int quit;
+#endif
+} StreamRing;
+
+/* write chunk k of the endless triangle stream into its slot */
+static void
+streamFillSlot(StreamRing *sr, size_t k)
+{
+  const BaseBuild *g = &sr->grid;
+  int slot = (int)(k % STREAM_RING_CHUNKS);
+  size_t first = (k % sr->chunksPerFrame)*sr->chunkTriangles;
+  size_t n = sr->frameTriangles - first < sr->chunkTriangles ?
+    sr->frameTriangles - first : sr->chunkTriangles;
+  StreamVertex *restrict v = sr->mapped + (size_t)slot*sr->chunkTriangles*3;
+  size_t t, tri = first % sr->meshTriangles;
+  double t0 = wesGetTime();
+
+  for (t=0;t<n;t++, v+=3)
+    {
+      /* same two triangles per quad as buildDisjointTriangleArrays */
+      size_t q = tri >> 1;
+      int i = (int)(q % g->nVertsPerAxis), j = (int)(q / g->nVertsPerAxis);
+      int c;
+      static const int corners[2][3][2] = { {{0,0},{1,0},{0,1}}, {{0,1},{1,0},{1,1}} };
+
+      for (c=0;c<3;c++)
+        {
+          int ci = i + corners[tri & 1][c][0], cj = j + corners[tri & 1][c][1];
+          v[c].x = g->x0 + ci*g->spacing;
+          v[c].y = g->y0 + cj*g->spacing;
+          v[c].r = ci*g->step;
+          v[c].g = cj*g->step;
+          v[c].b = 1.0F;
+        }
+      if (++tri == sr->meshTriangles)
+        tri = 0;
+    }
+  sr->slotTriangles[slot] = n;
+  sr->generateSeconds += wesGetTime() - t0;
+  sr->bytesGenerated += n*3*sizeof(StreamVertex);
+}
+
+#ifndef _WIN32
+static void *
+streamWorker(void *arg)
+{
+  StreamRing *sr = (StreamRing *)arg;
+  size_t k;
+
+  for (k=0;;k++)
+    {
+      int slot = (int)(k % STREAM_RING_CHUNKS);
+
+      pthread_mutex_lock(&sr->lock);
+      while (sr->state[slot] != STREAM_SLOT_FREE && !sr->quit)
+        pthread_cond_wait(&sr->changed, &sr->lock);
+      if (sr->quit)
+        {
+          pthread_mutex_unlock(&sr->lock);
+          return NULL;
+        }
+      sr->state[slot] = STREAM_SLOT_FILLING;
+      pthread_mutex_unlock(&sr->lock);
+
+      streamFillSlot(sr, k);
+
+      pthread_mutex_lock(&sr->lock);
+      sr->state[slot] = STREAM_SLOT_READY;
+      pthread_cond_broadcast(&sr->changed);
+      pthread_mutex_unlock(&sr->lock);
+    }
+}
+#endif
+
+static void
+setupStreamRing(StreamRing *sr, const AppState *as)
+{
+  size_t ringBytes;
+  int n;
+
+  if (!(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) ||
+      !(GLEW_VERSION_3_2 || GLEW_ARB_sync))
+    {
+      fprintf(stderr, "Error: -stream needs persistently mapped buffers (GL 4.4 or GL_ARB_buffer_storage) and fences\n");
+      exit(1);
+    }
+
+  memset(sr, 0, sizeof(*sr));
+  n = baseMeshGrid(&sr->grid, as->triangleAreaInPixels, as->imgWidth, as->imgHeight);
+  sr->meshTriangles = (size_t)n*n*2;
+  if (sr->meshTriangles == 0)
+    {
+      fprintf(stderr, "Error: a %.1f pixel triangle doesn't fit the window\n",
+              as->triangleAreaInPixels);
+      exit(1);
+    }
+  sr->frameTriangles = as->streamTriangles ? as->streamTriangles : sr->meshTriangles;
+  sr->chunkTriangles = as->streamChunkTriangles < sr->frameTriangles ?
+    as->streamChunkTriangles : sr->frameTriangles;
+  sr->chunksPerFrame = (sr->frameTriangles + sr->chunkTriangles - 1)/sr->chunkTriangles;
+
+  ringBytes = STREAM_RING_CHUNKS*sr->chunkTriangles*3*sizeof(StreamVertex);
+  glGenBuffers(1, &sr->buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, sr->buffer);
+  glBufferStorage(GL_ARRAY_BUFFER, ringBytes, NULL,
+                  GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+  sr->mapped = (StreamVertex *)glMapBufferRange(GL_ARRAY_BUFFER, 0, ringBytes,
+                                                GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                                                GL_MAP_COHERENT_BIT);
+  if (sr->mapped == NULL)
+    {
+      fprintf(stderr, "Error: couldn't map a %.1f MB streaming ring\n",
+              ringBytes/(1024.0*1024.0));
+      exit(1);
+    }
+  positionPointer(2, GL_FLOAT, sizeof(StreamVertex), (const GLvoid *)0);
+  colorPointer(3, GL_FLOAT, sizeof(StreamVertex), (const GLvoid *)(2*sizeof(float)));
+
+#ifndef _WIN32
+  pthread_mutex_init(&sr->lock, NULL);
+  pthread_cond_init(&sr->changed, NULL);
+  if (pthread_create(&sr->worker, NULL, streamWorker, sr) != 0)
+    {
+      fprintf(stderr, "Error: couldn't start the streaming worker thread\n");
+      exit(1);
+    }
+#endif
+}
+
+/* draw one frame's worth of chunks, recycling slots as their fences pass */
+static void
+submitStreamFrame(StreamRing *sr)
+{
+  size_t c;
+  int k;
+
+  for (c=0;c<sr->chunksPerFrame;c++)
+    {
+      size_t chunk = sr->drawChunk++;
+      int slot = (int)(chunk % STREAM_RING_CHUNKS);
+      double t0 = wesGetTime();
+
+#ifdef _WIN32
+      /* no worker: wait out the slot's fence and generate it here */
+      if (sr->state[slot] == STREAM_SLOT_INFLIGHT)
+        {
+          glClientWaitSync(sr->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1e10);
+          glDeleteSync(sr->fences[slot]);
+        }
+      sr->stallSeconds += wesGetTime() - t0;
+      streamFillSlot(sr, chunk);
+#else
+      pthread_mutex_lock(&sr->lock);
+      while (sr->state[slot] != STREAM_SLOT_READY)
+        {
+          if (sr->state[slot] == STREAM_SLOT_INFLIGHT)
+            {
+              /* the worker is blocked on this slot: wait for the GPU */
+              pthread_mutex_unlock(&sr->lock);
+              glClientWaitSync(sr->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1e10);
+              glDeleteSync(sr->fences[slot]);
+              pthread_mutex_lock(&sr->lock);
+              sr->state[slot] = STREAM_SLOT_FREE;
+              pthread_cond_broadcast(&sr->changed);
+            }
+          else
+            pthread_cond_wait(&sr->changed, &sr->lock);
+        }
+      pthread_mutex_unlock(&sr->lock);
+      sr->stallSeconds += wesGetTime() - t0;
+#endif
+
+      glDrawArrays(GL_TRIANGLES, (GLint)(slot*sr->chunkTriangles*3),
+                   (GLsizei)(sr->slotTriangles[slot]*3));
+      sr->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+#ifndef _WIN32
+      /* hand back any slots the GPU has already finished with */
+      pthread_mutex_lock(&sr->lock);
+      sr->state[slot] = STREAM_SLOT_INFLIGHT;
+      for (k=0;k<STREAM_RING_CHUNKS;k++)
+        if (k != slot && sr->state[k] == STREAM_SLOT_INFLIGHT &&
+            glClientWaitSync(sr->fences[k], 0, 0) != GL_TIMEOUT_EXPIRED)
+          {
+            glDeleteSync(sr->fences[k]);
+            sr->state[k] = STREAM_SLOT_FREE;
+            pthread_cond_broadcast(&sr->changed);
+          }
+      pthread_mutex_unlock(&sr->lock);
+#else
+      sr->state[slot] = STREAM_SLOT_INFLIGHT;
+      (void)k;
+#endif
+    }
+}
+
+static void
+destroyStreamRing(StreamRing *sr)
+{
+  int k;
+
+#ifndef _WIN32
+  pthread_mutex_lock(&sr->lock);
+  sr->quit = 1;
+  pthread_cond_broadcast(&sr->changed);
+  pthread_mutex_unlock(&sr->lock);
+  pthread_join(sr->worker, NULL);
+  pthread_mutex_destroy(&sr->lock);
+  pthread_cond_destroy(&sr->changed);
+#endif
+  for (k=0;k<STREAM_RING_CHUNKS;k++)
+    if (sr->state[k] == STREAM_SLOT_INFLIGHT)
+      {
+        glClientWaitSync(sr->fences[k], GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1e10);
+        glDeleteSync(sr->fences[k]);
+      }
+  glBindBuffer(GL_ARRAY_BUFFER, sr->buffer);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &sr->buffer);
+}
+
+/*
+ * Per-frame regions of a buffer the CPU writes without the driver
+ * synchronizing for it: unsynchronized maps and persistent mappings.
+ * When fenced, each region gets a fence after the frame that reads it
+ * and is waited on before it is written again, one region or many.
+ */
+typedef struct
+{
+  int nRegions, frame, fenced;
+  GLsync fences[MAX_UPLOAD_FRAMES_IN_FLIGHT];
+  double waitSeconds;
+} FrameRing;
+
+static void
+frameRingInit(FrameRing *fr, int nRegions, int fenced)
+{
+  memset(fr, 0, sizeof(*fr));
+  fr->nRegions = nRegions;
+  fr->fenced = fenced;
+}
+
+/* the region this frame writes, once the GPU has finished reading it */
+static int
+frameRingBegin(FrameRing *fr)
+{
+  int region = fr->frame % fr->nRegions;
+
+  if (fr->fenced && fr->fences[region] != NULL)
+    {
+      double t0 = wesGetTime();
+
+      glClientWaitSync(fr->fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1e10);
+      glDeleteSync(fr->fences[region]);
+      fr->fences[region] = NULL;
+      fr->waitSeconds += wesGetTime() - t0;
+    }
+  return region;
+}
+
+/* after the frame's draws: fence the region they read from */
+static void
+frameRingEnd(FrameRing *fr)
+{
+  if (fr->fenced)
+    fr->fences[fr->frame % fr->nRegions] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  fr->frame++;
+}
+
+static void
+frameRingDestroy(FrameRing *fr)
+{
+  int k;
+
+  for (k=0;k<fr->nRegions;k++)
+    if (fr->fences[k] != NULL)
+      glDeleteSync(fr->fences[k]);
+}
+
+/*
+ * Dynamic vertex upload (-upload). The mesh rotation moves from the
+ * modelview into the data: every frame the CPU rotates the float
+ * positions and pushes them to GL through one of the UploadMode
+ * strategies, while colors and indices stay in static buffers. The
+ * ring strategies keep uploadFramesInFlight regions in one buffer and
+ * fence each region after drawing from it. Time spent inside the
+ * upload calls and waiting on fences is what the driver or GPU made
+ * us wait; the rotation itself is counted separately.
+ */
+typedef struct
+{
+  UploadMode mode;
+  const Vertex2D *src;
+  size_t nVerts, bytes;
+  GLfloat cx, cy, degrees;
+  FrameRing ring;             /* fenced for the unsynchronized and persistent writes */
+  GLuint buffer;
+  Vertex2D *scratch;          /* orphan and subdata upload from here */
+  Vertex2D *persistent;       /* the mapped ring of UPLOAD_PERSISTENT */
+  double callSeconds, rotateSeconds;
+  size_t bytesUploaded;
+} Uploader;
+
+static int
+uploadModeSupported(UploadMode mode)
+{
+  if (mode == UPLOAD_MAP_INVALIDATE || mode == UPLOAD_MAP_UNSYNCHRONIZED)
+    return GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+  if (mode == UPLOAD_PERSISTENT)
+    return (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) &&
+      (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+  return 1;
+}
+
+static void
+rotatePositions(Vertex2D *restrict dst, const Vertex2D *restrict src, size_t n,
+                GLfloat cx, GLfloat cy, GLfloat degrees)
+{
+  float c = cosf(degrees*(float)M_PI/180.0F), s = sinf(degrees*(float)M_PI/180.0F);
+  size_t k;
+
+  for (k=0;k<n;k++)
+    {
+      float x = src[k].x - cx, y = src[k].y - cy;
+      dst[k].x = cx + x*c - y*s;
+      dst[k].y = cy + x*s + y*c;
+    }
+}
+
+static void
+setupUploader(Uploader *up, UploadMode mode, int framesInFlight,
+              const Vertex2D *verts, int vertexCount, GLfloat cx, GLfloat cy)
+{
+  memset(up, 0, sizeof(*up));
+  up->mode = mode;
+  up->src = verts;
+  up->nVerts = vertexCount;
+  up->bytes = sizeof(Vertex2D)*(size_t)vertexCount;
+  up->cx = cx;
+  up->cy = cy;
+  if (mode == UPLOAD_MAP_UNSYNCHRONIZED || mode == UPLOAD_PERSISTENT)
+    frameRingInit(&up->ring, framesInFlight, 1);
+  else
+    frameRingInit(&up->ring, 1, 0);
+
+  glGenBuffers(1, &up->buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, up->buffer);
+  if (mode == UPLOAD_PERSISTENT)
+    {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+      glBufferStorage(GL_ARRAY_BUFFER, up->bytes*up->ring.nRegions, NULL, flags);
+      up->persistent = (Vertex2D *)glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                                    up->bytes*up->ring.nRegions, flags);
+      if (up->persistent == NULL)
+        {
+          fprintf(stderr, "Error: couldn't map a %.1f MB upload ring\n",
+                  up->bytes*up->ring.nRegions/(1024.0*1024.0));
+          exit(1);
+        }
+    }
+  else
+    glBufferData(GL_ARRAY_BUFFER, up->bytes*up->ring.nRegions, verts, GL_STREAM_DRAW);
+
+  if (mode == UPLOAD_ORPHAN || mode == UPLOAD_SUBDATA)
+    {
+      up->scratch = (Vertex2D *)malloc(up->bytes);
+      if (up->scratch == NULL)
+        {
+          fprintf(stderr, "Error: out of memory allocating %.1f MB of upload scratch\n",
+                  up->bytes/(1024.0*1024.0));
+          exit(1);
+        }
+    }
+}
+
+/* rotate this frame's positions into GL and point the vertex array at them */
+static void
+uploadFrame(Uploader *up)
+{
+  /* the ring strategies must not overwrite a region the GPU still reads */
+  int region = frameRingBegin(&up->ring);
+  size_t offset = (size_t)region*up->bytes;
+  Vertex2D *dst;
+  double t0, t1;
+
+  up->degrees += 0.01F;       /* what glRotatef did to the modelview */
+  glBindBuffer(GL_ARRAY_BUFFER, up->buffer);
+
+  switch (up->mode)
+    {
+    case UPLOAD_ORPHAN:
+    case UPLOAD_SUBDATA:
+      t0 = wesGetTime();
+      rotatePositions(up->scratch, up->src, up->nVerts, up->cx, up->cy, up->degrees);
+      t1 = wesGetTime();
+      if (up->mode == UPLOAD_ORPHAN)
+        glBufferData(GL_ARRAY_BUFFER, up->bytes, up->scratch, GL_STREAM_DRAW);
+      else
+        glBufferSubData(GL_ARRAY_BUFFER, 0, up->bytes, up->scratch);
+      up->rotateSeconds += t1 - t0;
+      up->callSeconds += wesGetTime() - t1;
+      break;
+
+    case UPLOAD_MAP_INVALIDATE:
+    case UPLOAD_MAP_UNSYNCHRONIZED:
+      t0 = wesGetTime();
+      dst = (Vertex2D *)glMapBufferRange(GL_ARRAY_BUFFER, offset, up->bytes,
+                                         GL_MAP_WRITE_BIT |
+                                         (up->mode == UPLOAD_MAP_INVALIDATE ?
+                                          GL_MAP_INVALIDATE_BUFFER_BIT :
+                                          GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+      t1 = wesGetTime();
+      up->callSeconds += t1 - t0;
+      if (dst == NULL)
+        {
+          fprintf(stderr, "Error: glMapBufferRange failed during -upload\n");
+          exit(1);
+        }
+      rotatePositions(dst, up->src, up->nVerts, up->cx, up->cy, up->degrees);
+      t0 = wesGetTime();
+      up->rotateSeconds += t0 - t1;
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      up->callSeconds += wesGetTime() - t0;
+      break;
+
+    case UPLOAD_PERSISTENT:
+      t0 = wesGetTime();
+      rotatePositions(up->persistent + (size_t)region*up->nVerts, up->src, up->nVerts,
+                      up->cx, up->cy, up->degrees);
+      up->rotateSeconds += wesGetTime() - t0;
+      break;
+
+    default:
+      break;
+    }
+
+  positionPointer(2, GL_FLOAT, 0, (const GLvoid *)offset);
+  up->bytesUploaded += up->bytes;
+}
+
+/* after the frame's draw: fence the region it read from */
+static void
+uploadFrameDone(Uploader *up)
+{
+  frameRingEnd(&up->ring);
+}
+
+static void
+destroyUploader(Uploader *up)
+{
+  frameRingDestroy(&up->ring);
+  glBindBuffer(GL_ARRAY_BUFFER, up->buffer);
+  if (up->persistent != NULL)
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &up->buffer);
+  free(up->scratch);
+}
+
+/* issue one frame's worth of triangles with whichever call suits the type */
+static void
+dispatchDraw(GLenum primitive,
+             int vertexCount,
+             GLenum indexType,
+             int indexCount,
+             const GLvoid *indices)
+{
+  if (indexType == 0)
+    glDrawArrays(primitive, 0, vertexCount);
+  else
+    glDrawElements(primitive, indexCount, indexType, indices);
+}
+
+/*
+ * Draw-call overhead: the same dispatch arrays, split into N draws of
+ * batchVerts vertices each and submitted one of several ways. The
+ * instanced mode can't address a different vertex range per instance,
+ * so it draws the first batch N times, each instance shifted by a
+ * per-instance offset towards where its batch would have been (clamped
+ * so it stays on the mesh and therefore on screen).
+ */
+typedef struct
+{
+  GLuint count, instanceCount, first, baseInstance; /* GL's layout */
+} DrawArraysIndirectCommand;
+
+typedef struct
+{
+  SubmitMode mode;
+  int        nDraws;
+  GLsizei    batchVerts;
+  GLint     *firsts;
+  GLsizei   *counts;
+  GLuint     indirectBuffer;
+  GLuint     offsetBuffer;    /* per-instance offsets, SUBMIT_INSTANCED */
+  GLuint     program;         /* SUBMIT_INSTANCED */
+  GLint      savedProgram;
+} DrawBatches;
+
+static const GLchar instancedVertexSource[] =
+  "#version 120\n"
+  "attribute vec2 position;\n"
+  "attribute vec3 color;\n"
+  "attribute vec2 instanceOffset;\n"
+  "void main()\n"
+  "{\n"
+  "    gl_FrontColor = vec4(color, 1.0);\n"
+  "    gl_Position = gl_ModelViewProjectionMatrix * vec4(position + instanceOffset, 0.0, 1.0);\n"
+  "}\n";
+
+static const GLchar instancedFragmentSource[] =
+  "#version 120\n"
+  "void main()\n"
+  "{\n"
+  "    gl_FragColor = gl_Color;\n"
+  "}\n";
+
+static void
+setupDrawBatches(DrawBatches *db,
+                 SubmitMode mode,
+                 size_t vertexBufLimit,
+                 int vertexCount,
+                 const Vertex2D *verts,
+                 GLuint vertBuffer,
+                 GLuint colorBuffer)
+{
+  int k;
+
+  memset(db, 0, sizeof(*db));
+  db->mode = mode;
+  db->batchVerts = (vertexBufLimit < (size_t)vertexCount) ?
+    (GLsizei)(vertexBufLimit/3)*3 : vertexCount;
+  if (db->batchVerts < 3)
+    db->batchVerts = 3;
+  db->nDraws = (vertexCount + db->batchVerts - 1)/db->batchVerts;
+
+  db->firsts = (GLint *)malloc(sizeof(GLint)*db->nDraws);
+  db->counts = (GLsizei *)malloc(sizeof(GLsizei)*db->nDraws);
+  for (k=0;k<db->nDraws;k++)
+    {
+      db->firsts[k] = k*db->batchVerts;
+      db->counts[k] = (k == db->nDraws-1) ?
+        vertexCount - db->firsts[k] : db->batchVerts;
+    }
+
+  if (mode == SUBMIT_INDIRECT)
+    {
+      DrawArraysIndirectCommand *cmds;
+
+      if (!(GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect))
+        {
+          fprintf(stderr, "Error: -sm 4 needs GL 4.3 or ARB_multi_draw_indirect\n");
+          exit(1);
+        }
+      cmds = (DrawArraysIndirectCommand *)malloc(sizeof(*cmds)*db->nDraws);
+      for (k=0;k<db->nDraws;k++)
+        {
+          cmds[k].first = db->firsts[k];
+          cmds[k].count = db->counts[k];
+          cmds[k].instanceCount = 1;
+          cmds[k].baseInstance = 0;
+        }
+      glGenBuffers(1, &db->indirectBuffer);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, db->indirectBuffer);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(*cmds)*db->nDraws,
+                   cmds, GL_STATIC_DRAW);
+      free(cmds);
+    }
+  else if (mode == SUBMIT_INSTANCED)
+    {
+      static const char *attribs[] = {"position", "color", "instanceOffset", NULL};
+      Vertex2D *offsets, bMin, bMax, mMin, mMax;
+      int v;
+
+      if (!(GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced)))
+        {
+          fprintf(stderr, "Error: -sm 3 needs GL 3.3 or ARB_instanced_arrays\n");
+          exit(1);
+        }
+
+      /* bounding boxes of the first batch and of the whole mesh */
+      bMin = bMax = mMin = mMax = verts[0];
+      for (v=0;v<vertexCount;v++)
+        {
+          Vertex2D p = verts[v];
+          if (v < db->batchVerts)
+            {
+              bMin.x = fminf(bMin.x, p.x); bMin.y = fminf(bMin.y, p.y);
+              bMax.x = fmaxf(bMax.x, p.x); bMax.y = fmaxf(bMax.y, p.y);
+            }
+          mMin.x = fminf(mMin.x, p.x); mMin.y = fminf(mMin.y, p.y);
+          mMax.x = fmaxf(mMax.x, p.x); mMax.y = fmaxf(mMax.y, p.y);
+        }
+
+      offsets = (Vertex2D *)malloc(sizeof(Vertex2D)*db->nDraws);
+      for (k=0;k<db->nDraws;k++)
+        {
+          Vertex2D o;
+          o.x = verts[db->firsts[k]].x - verts[0].x;
+          o.y = verts[db->firsts[k]].y - verts[0].y;
+          o.x = fmaxf(mMin.x - bMin.x, fminf(o.x, mMax.x - bMax.x));
+          o.y = fmaxf(mMin.y - bMin.y, fminf(o.y, mMax.y - bMax.y));
+          offsets[k] = o;
+        }
+      glGenBuffers(1, &db->offsetBuffer);
+      glBindBuffer(GL_ARRAY_BUFFER, db->offsetBuffer);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex2D)*db->nDraws,
+                   offsets, GL_STATIC_DRAW);
+      free(offsets);
+
+      db->program = make_program_source(instancedVertexSource,
+                                        instancedFragmentSource,
+                                        attribs, "instanced submission");
+      if (db->program == 0)
+        exit(1);
+      glGetIntegerv(GL_CURRENT_PROGRAM, &db->savedProgram);
+      glUseProgram(db->program);
+
+      /* generic attributes replace the fixed-function arrays here */
+      glDisableClientState(GL_VERTEX_ARRAY);
+      glDisableClientState(GL_COLOR_ARRAY);
+      glBindBuffer(GL_ARRAY_BUFFER, vertBuffer);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+      glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+      glBindBuffer(GL_ARRAY_BUFFER, db->offsetBuffer);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+      glVertexAttribDivisor(2, 1);
+      glEnableVertexAttribArray(0);
+      glEnableVertexAttribArray(1);
+      glEnableVertexAttribArray(2);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+/* triangles actually drawn per frame, which instancing rounds up */
+static int
+drawBatchesTriangles(const DrawBatches *db, int dispatchTriangles)
+{
+  if (db->mode == SUBMIT_INSTANCED)
+    return db->nDraws*(db->batchVerts/3);
+  return dispatchTriangles;
+}
+
+static void
+submitDrawBatches(const DrawBatches *db)
+{
+  int k;
+
+  switch (db->mode)
+    {
+    case SUBMIT_DRAW_LOOP:
+      for (k=0;k<db->nDraws;k++)
+        glDrawArrays(GL_TRIANGLES, db->firsts[k], db->counts[k]);
+      break;
+    case SUBMIT_MULTI_DRAW:
+      glMultiDrawArrays(GL_TRIANGLES, db->firsts, db->counts, db->nDraws);
+      break;
+    case SUBMIT_INSTANCED:
+      glDrawArraysInstanced(GL_TRIANGLES, 0, db->batchVerts, db->nDraws);
+      break;
+    case SUBMIT_INDIRECT:
+      glMultiDrawArraysIndirect(GL_TRIANGLES, (const GLvoid *)0, db->nDraws, 0);
+      break;
+    default:
+      break;
+    }
+}
+
+static void
+destroyDrawBatches(DrawBatches *db)
+{
+  if (db->mode == SUBMIT_INSTANCED)
+    {
+      glVertexAttribDivisor(2, 0);
+      glDisableVertexAttribArray(0);
+      glDisableVertexAttribArray(1);
+      glDisableVertexAttribArray(2);
+      glUseProgram(db->savedProgram);
+      glDeleteProgram(db->program);
+      glDeleteBuffers(1, &db->offsetBuffer);
+    }
+  if (db->mode == SUBMIT_INDIRECT)
+    {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      glDeleteBuffers(1, &db->indirectBuffer);
+    }
+  free(db->firsts);
+  free(db->counts);
+}
+
+/*
+ * -core: the program every run draws with, and its transform. There is
+ * no matrix stack, so the pixel to NDC scale and the rotation the
+ * fixed-function path accumulates with glRotatef are composed on the
+ * CPU and written into the Transform block once per frame.
+ */
+static const GLchar coreVertexSource[] =
+  "#version 330 core\n"
+  "layout(std140) uniform Transform\n"
+  "{\n"
+  "    mat4 mvp;\n"
+  "};\n"
+  "in vec2 position;\n"
+  "in vec4 color;\n"
+  "out vec4 vColor;\n"
+  "void main()\n"
+  "{\n"
+  "    vColor = color;\n"
+  "    gl_Position = mvp * vec4(position, 0.0, 1.0);\n"
+  "}\n";
+
+static const GLchar coreFragmentSource[] =
+  "#version 330 core\n"
+  "in vec4 vColor;\n"
+  "out vec4 fragColor;\n"
+  "void main()\n"
+  "{\n"
+  "    fragColor = vColor;\n"
+  "}\n";
+
+/* floating point operations per fragment, counting a MAD as 2 and a sin() as 1 */
+static double
+fragWorkloadFlops(const FragWorkload *fw)
+{
+  return (double)fw->loops*(2.0*(fw->ops - fw->trans) + fw->trans);
+}
+
+/* append printf-style text to a generated shader */
+static void
+shaderAppend(GLchar *src, size_t size, size_t *n, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  if (*n < size)
+    *n += vsnprintf(src + *n, size - *n, fmt, ap);
+  va_end(ap);
+}
+
+/* the workload loop itself, with its multiply-add constants named by k */
+static void
+appendFragWorkloadLoop(GLchar *src, size_t size, size_t *n,
+                       const FragWorkload *fw, const char *mulK, const char *addK)
+{
+  int k;
+
+  shaderAppend(src, size, n,
+               "    for (int i = 0; i < loops; i++)\n"
+               "    {\n");
+  for (k=0;k<fw->ops;k++)
+    {
+      int c = k % fw->chains;
+      if ((k + 1)*fw->trans/fw->ops != k*fw->trans/fw->ops)
+        shaderAppend(src, size, n, "        c%d = sin(c%d);\n", c, c);
+      else
+        shaderAppend(src, size, n, "        c%d = c%d*%s + %s;\n", c, c, mulK, addK);
+    }
+  shaderAppend(src, size, n, "    }\n");
+}
+
+/*
+ * The -frag workload: a loop whose trip count and constants are
+ * uniforms, and whose result reaches the output through a uniform that
+ * is 0 at run time, so the compiler can neither fold nor drop it.
+ * The transcendentals are spread evenly through the iteration. With
+ * -diverge there are three copies of the loop with different constants,
+ * and each fragment runs exactly one of them. core selects GLSL 3.30
+ * for -core, the body is shared through FRAG_COLOR.
+ */
+static GLchar *
+makeFragWorkloadSource(const FragWorkload *fw, int core)
+{
+  size_t size = 2048 + 3*64*(size_t)(fw->ops + fw->chains);
+  GLchar *src = (GLchar *)malloc(size);
+  size_t n = 0;
+  int k;
+
+  if (src == NULL)
+    {
+      fprintf(stderr, "Error: out of memory generating the -frag shader\n");
+      exit(1);
+    }
+  if (core)
+    shaderAppend(src, size, &n,
+                 "#version 330 core\n"
+                 "in vec4 vColor;\n"
+                 "out vec4 fragColor;\n"
+                 "#define FRAG_IN vColor\n"
+                 "#define FRAG_COLOR fragColor\n");
+  else
+    shaderAppend(src, size, &n,
+                 "#version 110\n"
+                 "#define FRAG_IN gl_Color\n"
+                 "#define FRAG_COLOR gl_FragColor\n");
+  shaderAppend(src, size, &n,
+               "#define TILE %d.0\n"
+               "uniform int loops, pick;\n"
+               "uniform vec3 mulK, addK;\n"
+               "uniform float sink;\n"
+               "void main()\n"
+               "{\n", DIVERGE_TILE_PIXELS);
+  for (k=0;k<fw->chains;k++)
+    shaderAppend(src, size, &n,
+                 "    float c%d = gl_FragCoord.x*0.001 + %d.0;\n", k, k);
+
+  switch (fw->branch)
+    {
+    case BRANCH_NONE:
+      appendFragWorkloadLoop(src, size, &n, fw, "mulK.x", "addK.x");
+      break;
+
+    case BRANCH_MIX:
+      shaderAppend(src, size, &n,
+                   "    float f = floor(mod(gl_FragCoord.x, 3.0));\n"
+                   "    float m1 = step(0.5, f), m2 = step(1.5, f);\n"
+                   "    float mk = mix(mix(mulK.x, mulK.y, m1), mulK.z, m2);\n"
+                   "    float ak = mix(mix(addK.x, addK.y, m1), addK.z, m2);\n");
+      appendFragWorkloadLoop(src, size, &n, fw, "mk", "ak");
+      break;
+
+    default:
+      if (fw->branch == BRANCH_UNIFORM)
+        shaderAppend(src, size, &n, "    int m = pick;\n");
+      else if (fw->branch == BRANCH_TILE)
+        shaderAppend(src, size, &n,
+                     "    int m = int(mod(floor(gl_FragCoord.x/TILE), 3.0));\n");
+      else
+        shaderAppend(src, size, &n, "    int m = int(mod(gl_FragCoord.x, 3.0));\n");
+      shaderAppend(src, size, &n, "    if (m == 0) {\n");
+      appendFragWorkloadLoop(src, size, &n, fw, "mulK.x", "addK.x");
+      shaderAppend(src, size, &n, "    } else if (m == 1) {\n");
+      appendFragWorkloadLoop(src, size, &n, fw, "mulK.y", "addK.y");
+      shaderAppend(src, size, &n, "    } else {\n");
+      appendFragWorkloadLoop(src, size, &n, fw, "mulK.z", "addK.z");
+      shaderAppend(src, size, &n, "    }\n");
+      break;
+    }
+
+  shaderAppend(src, size, &n, "    FRAG_COLOR = FRAG_IN + sink*vec4(c0");
+  for (k=1;k<fw->chains;k++)
+    shaderAppend(src, size, &n, " + c%d", k);
+  shaderAppend(src, size, &n,
+               ");\n"
+               "}\n");
+  if (n >= size)
+    {
+      fprintf(stderr, "Error: the generated -frag shader overflowed its buffer\n");
+      exit(1);
+    }
+  return src;
+}
+
+/*
+ * -attribs N: the first N of position, color, normal, texcoord and up
+ * to MAX_FETCH_ATTRIBS-FETCH_FIXED_ATTRIBS generated extras, each
+ * -attribwidth floats. The extras are interleaved in one buffer made
+ * for the run, the rest come from the mesh buffers.
+ */
+typedef struct
+{
+  GLuint extraBuffer;
+  int    nAttribs;
+} FetchArrays;
+
+static const char *fetchAttribNames[MAX_FETCH_ATTRIBS+1] =
+  {
+    "position", "color", "normal", "texcoord",
+    "extra0", "extra1", "extra2", "extra3", "extra4", "extra5",
+    "extra6", "extra7", "extra8", "extra9", "extra10", "extra11",
+    NULL
+  };
+
+/* returns the bytes fetched per vertex */
+static size_t
+setupFetchArrays(FetchArrays *fa, const AppState *as, const MeshEntry *mesh,
+                 const GLuint *buffers, const VertexLayout *layout)
+{
+  int nExtra = as->fetchAttribs - FETCH_FIXED_ATTRIBS, width = as->fetchWidth;
+  size_t bytes = positionFormats[layout->pf].bytes;
+  int k;
+
+  fa->nAttribs = as->fetchAttribs;
+  fa->extraBuffer = 0;
+  if (fa->nAttribs < 2)
+    glDisableVertexAttribArray(1);
+  else
+    bytes += colorFormats[layout->cf].bytes;
+  if (fa->nAttribs > 2)
+    {
+      bindNormals(mesh->dispatchNormals, buffers[3], 1);
+      bytes += sizeof(Vertex3D);
+    }
+  if (fa->nAttribs > 3)
+    {
+      bindAttribArray(3, 2, sizeof(Vertex2D), (const GLvoid *)0, buffers[4], 1);
+      bytes += sizeof(Vertex2D);
+    }
+  if (nExtra > 0)
+    {
+      size_t nVerts = (size_t)mesh->dispatchVertexCount;
+      size_t stride = sizeof(GLfloat)*nExtra*width;
+      GLfloat *extra = (GLfloat *)malloc(stride*nVerts), *e = extra;
+      size_t v;
+
+      if (extra == NULL)
+        {
+          fprintf(stderr, "Error: out of memory for %d -attribs extras\n", nExtra);
+          exit(1);
+        }
+      for (v=0;v<nVerts;v++)
+        for (k=0;k<nExtra*width;k++)
+          *e++ = mesh->dispatchVerts[v].x*(1.0F/(k+1)) + mesh->dispatchVerts[v].y;
+      glGenBuffers(1, &fa->extraBuffer);
+      glBindBuffer(GL_ARRAY_BUFFER, fa->extraBuffer);
+      glBufferData(GL_ARRAY_BUFFER, stride*nVerts, extra, GL_STATIC_DRAW);
+      free(extra);
+      for (k=0;k<nExtra;k++)
+        bindAttribArray(FETCH_FIXED_ATTRIBS+k, width, (GLsizei)stride,
+                        (const GLvoid *)(sizeof(GLfloat)*k*width), 0, 1);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      bytes += stride;
+    }
+  return bytes;
+}
+
+static void
+destroyFetchArrays(FetchArrays *fa)
+{
+  int k;
+
+  for (k=2;k<fa->nAttribs;k++)
+    glDisableVertexAttribArray(k);
+  if (fa->extraBuffer != 0)
+    glDeleteBuffers(1, &fa->extraBuffer);
+}
+
+/*
+ * The -attribs vertex shader: every bound attribute feeds the color
+ * through a sink uniform that is 0 at run time, so none of them can be
+ * dropped as inactive and every one is actually fetched.
+ */
+static GLchar *
+makeFetchSource(int nAttribs, int width, int core)
+{
+  static const char *vecTypes[] = { "float", "vec2", "vec3", "vec4" };
+  static const char *ones[] = { "1.0", "vec2(1.0)", "vec3(1.0)", "vec4(1.0)" };
+  size_t size = 2048 + 128*(size_t)nAttribs;
+  GLchar *src = (GLchar *)malloc(size);
+  const char *in = core ? "in" : "attribute";
+  size_t n = 0;
+  int k;
+
+  if (src == NULL)
+    {
+      fprintf(stderr, "Error: out of memory generating the -attribs shader\n");
+      exit(1);
+    }
+  if (core)
+    shaderAppend(src, size, &n,
+                 "#version 330 core\n"
+                 "layout(std140) uniform Transform\n"
+                 "{\n"
+                 "    mat4 mvp;\n"
+                 "};\n"
+                 "out vec4 vColor;\n"
+                 "#define MVP mvp\n"
+                 "#define COLOR_OUT vColor\n");
+  else
+    shaderAppend(src, size, &n,
+                 "#version 110\n"
+                 "#define MVP gl_ModelViewProjectionMatrix\n"
+                 "#define COLOR_OUT gl_FrontColor\n");
+  shaderAppend(src, size, &n, "uniform float sink;\n%s vec2 position;\n", in);
+  if (nAttribs > 1)
+    shaderAppend(src, size, &n, "%s vec4 color;\n", in);
+  if (nAttribs > 2)
+    shaderAppend(src, size, &n, "%s vec3 normal;\n", in);
+  if (nAttribs > 3)
+    shaderAppend(src, size, &n, "%s vec2 texcoord;\n", in);
+  for (k=FETCH_FIXED_ATTRIBS;k<nAttribs;k++)
+    shaderAppend(src, size, &n, "%s %s %s;\n", in, vecTypes[width-1], fetchAttribNames[k]);
+  shaderAppend(src, size, &n,
+               "void main()\n"
+               "{\n"
+               "    vec4 c = %s;\n"
+               "    float s = 0.0;\n", nAttribs > 1 ? "color" : "vec4(1.0)");
+  if (nAttribs > 2)
+    shaderAppend(src, size, &n, "    s += dot(normal, vec3(1.0));\n");
+  if (nAttribs > 3)
+    shaderAppend(src, size, &n, "    s += texcoord.x + texcoord.y;\n");
+  for (k=FETCH_FIXED_ATTRIBS;k<nAttribs;k++)
+    shaderAppend(src, size, &n, "    s += dot(%s, %s);\n", fetchAttribNames[k], ones[width-1]);
+  shaderAppend(src, size, &n,
+               "    COLOR_OUT = c + vec4(sink*s);\n"
+               "    gl_Position = MVP*vec4(position, 0.0, 1.0);\n"
+               "}\n");
+  if (n >= size)
+    {
+      fprintf(stderr, "Error: the generated -attribs shader overflowed its buffer\n");
+      exit(1);
+    }
+  return src;
+}
+
+/*
+ * -tex: one texture sampled in every fragment through the mesh
+ * texcoords, which span the texture once across the mesh. The texels
+ * are noise, so nothing about them compresses or repeats.
+ */
+typedef struct
+{
+  GLuint texture;
+  GLuint randomBuffer;        /* the TEX_RANDOM texcoords, 0 otherwise */
+  int    taps;                /* texels per filtered sample */
+  double workingSetTexels;    /* distinct texels one frame touches, estimated */
+} TexturePass;
+
+/* a cheap integer hash, for the TEX_RANDOM offsets */
+static unsigned int
+hashInt(unsigned int x)
+{
+  x = (x ^ 61u) ^ (x >> 16);
+  x *= 9u;
+  x ^= x >> 4;
+  x *= 0x27d4eb2du;
+  x ^= x >> 15;
+  return x;
+}
+
+/*
+ * Distinct texels a frame touches. The mesh spans meshPixels on a side
+ * and the texture scale times that, so a pixel steps r texels along an
+ * axis. Trilinear filtering samples the level where r drops below 2
+ * and the one under it. Without mips, minifying touches no more than
+ * the footprints of the covered pixels. Random offsets touch the same
+ * set, just without the locality.
+ */
+static double
+texWorkingSetTexels(const AppState *as, int meshPixels, int taps)
+{
+  double scale = as->texAccess == TEX_SCALED ? as->texScale : 1.0;
+  double r = (double)as->texSize*scale/meshPixels;
+  double side = as->texSize, texels;
+
+  if (as->texFilter == TEX_TRILINEAR)
+    while (r >= 2.0 && side >= 2.0)
+      {
+        r *= 0.5;
+        side = floor(side*0.5);
+      }
+  texels = side*side*(scale < 1.0 ? scale*scale : 1.0);
+  if (as->texFilter == TEX_TRILINEAR && side >= 2.0)
+    texels *= 1.25;
+  if (texels > (double)meshPixels*meshPixels*taps)
+    texels = (double)meshPixels*meshPixels*taps;
+  return texels;
+}
+
+static void
+setupTexturePass(TexturePass *tp, const AppState *as, const MeshEntry *mesh,
+                 const GLuint *buffers)
+{
+  static const int taps[] = { 1, 4, 8 };
+  const TexFormat *fmt = &texFormats[as->texFormat];
+  int meshPixels = (as->imgWidth < as->imgHeight ? as->imgWidth : as->imgHeight) >> 1;
+  size_t nTexels = (size_t)as->texSize*as->texSize, k;
+  unsigned char *texels;
+  GLint maxSize, program;
+  unsigned int seed = 2463534242u;
+
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  if (as->texSize > maxSize)
+    {
+      fprintf(stderr, "Error: -tex %d is over this GL's %d texel limit\n", as->texSize, maxSize);
+      exit(1);
+    }
+  if (as->texAniso > 1 &&
+      !GLEW_EXT_texture_filter_anisotropic && !GLEW_ARB_texture_filter_anisotropic)
+    {
+      fprintf(stderr, "Error: -aniso needs anisotropic filtering, which this GL doesn't have\n");
+      exit(1);
+    }
+  texels = (unsigned char *)malloc(nTexels*4);
+  if (texels == NULL)
+    {
+      fprintf(stderr, "Error: out of memory for a %dx%d texture\n", as->texSize, as->texSize);
+      exit(1);
+    }
+  for (k=0;k<nTexels;k++)
+    {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      memcpy(texels + 4*k, &seed, 4);
+    }
+
+  glActiveTexture(GL_TEXTURE0);
+  glGenTextures(1, &tp->texture);
+  glBindTexture(GL_TEXTURE_2D, tp->texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, fmt->internalFormat, as->texSize, as->texSize, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, texels);
+  free(texels);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                  as->texFilter == TEX_NEAREST ? GL_NEAREST : GL_LINEAR);
+  if (as->texFilter == TEX_TRILINEAR)
+    {
+      glGenerateMipmap(GL_TEXTURE_2D);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+  else
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    as->texFilter == TEX_NEAREST ? GL_NEAREST : GL_LINEAR);
+  if (as->texAniso > 1)
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, (GLfloat)as->texAniso);
+
+  tp->randomBuffer = 0;
+  if (as->texAccess == TEX_RANDOM)
+    {
+      /* all three corners of a triangle get the same offset */
+      size_t nVerts = (size_t)mesh->dispatchVertexCount, v;
+      Vertex2D *tcs = (Vertex2D *)malloc(sizeof(Vertex2D)*nVerts);
+
+      if (tcs == NULL)
+        {
+          fprintf(stderr, "Error: out of memory for the random texcoords\n");
+          exit(1);
+        }
+      for (v=0;v<nVerts;v++)
+        {
+          unsigned int h = hashInt((unsigned int)(v/3));
+
+          tcs[v].x = mesh->dispatchTCs[v].x + (float)(h & 0xffffu)*(1.0F/65536.0F);
+          tcs[v].y = mesh->dispatchTCs[v].y + (float)(h >> 16)*(1.0F/65536.0F);
+        }
+      glGenBuffers(1, &tp->randomBuffer);
+      glBindBuffer(GL_ARRAY_BUFFER, tp->randomBuffer);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex2D)*nVerts, tcs, GL_STATIC_DRAW);
+      free(tcs);
+      bindAttribArray(3, 2, sizeof(Vertex2D), (const GLvoid *)0, 0, 1);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+  else
+    bindAttribArray(3, 2, sizeof(Vertex2D), (const GLvoid *)0, buffers[4], 1);
+
+  glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+  glUniform2f(glGetUniformLocation(program, "tcScale"),
+              as->texAccess == TEX_SCALED ? (GLfloat)as->texScale : 1.0F,
+              as->texAccess == TEX_SCALED ? (GLfloat)as->texScale : 1.0F);
+
+  tp->taps = taps[as->texFilter];
+  tp->workingSetTexels = texWorkingSetTexels(as, meshPixels, tp->taps);
+}
+
+static void
+destroyTexturePass(TexturePass *tp)
+{
+  glDisableVertexAttribArray(3);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDeleteTextures(1, &tp->texture);
+  if (tp->randomBuffer != 0)
+    glDeleteBuffers(1, &tp->randomBuffer);
+}
+
+/* the -tex shaders: the interpolated color modulated by one texture sample */
+static GLchar *
+makeTextureSource(GLenum type, int core)
+{
+  size_t size = 1024, n = 0;
+  GLchar *src = (GLchar *)malloc(size);
+
+  if (src == NULL)
+    {
+      fprintf(stderr, "Error: out of memory generating the -tex shaders\n");
+      exit(1);
+    }
+  if (type == GL_VERTEX_SHADER)
+    {
+      if (core)
+        shaderAppend(src, size, &n,
+                     "#version 330 core\n"
+                     "layout(std140) uniform Transform\n"
+                     "{\n"
+                     "    mat4 mvp;\n"
+                     "};\n"
+                     "in vec2 position;\n"
+                     "in vec4 color;\n"
+                     "in vec2 texcoord;\n"
+                     "out vec4 vColor;\n"
+                     "out vec2 vTexcoord;\n"
+                     "#define MVP mvp\n"
+                     "#define COLOR_OUT vColor\n");
+      else
+        shaderAppend(src, size, &n,
+                     "#version 110\n"
+                     "attribute vec2 position;\n"
+                     "attribute vec4 color;\n"
+                     "attribute vec2 texcoord;\n"
+                     "varying vec2 vTexcoord;\n"
+                     "#define MVP gl_ModelViewProjectionMatrix\n"
+                     "#define COLOR_OUT gl_FrontColor\n");
+      shaderAppend(src, size, &n,
+                   "uniform vec2 tcScale;\n"
+                   "void main()\n"
+                   "{\n"
+                   "    COLOR_OUT = color;\n"
+                   "    vTexcoord = texcoord*tcScale;\n"
+                   "    gl_Position = MVP*vec4(position, 0.0, 1.0);\n"
+                   "}\n");
+    }
+  else
+    {
+      if (core)
+        shaderAppend(src, size, &n,
+                     "#version 330 core\n"
+                     "in vec4 vColor;\n"
+                     "in vec2 vTexcoord;\n"
+                     "out vec4 fragColor;\n"
+                     "#define COLOR_IN vColor\n"
+                     "#define COLOR_OUT fragColor\n"
+                     "#define TEXTURE texture\n");
+      else
+        shaderAppend(src, size, &n,
+                     "#version 110\n"
+                     "varying vec2 vTexcoord;\n"
+                     "#define COLOR_IN gl_Color\n"
+                     "#define COLOR_OUT gl_FragColor\n"
+                     "#define TEXTURE texture2D\n");
+      shaderAppend(src, size, &n,
+                   "uniform sampler2D tex;\n"
+                   "void main()\n"
+                   "{\n"
+                   "    COLOR_OUT = COLOR_IN*TEXTURE(tex, vTexcoord);\n"
+                   "}\n");
+    }
+  if (n >= size)
+    {
+      fprintf(stderr, "Error: the generated -tex shader overflowed its buffer\n");
+      exit(1);
+    }
+  return src;
+}
+
+/*
+ * Rough floating point operations per vertex: 28 for each mat4 x vec4
+ * (16 multiplies, 12 adds), 8 more per bone to weight and accumulate,
+ * and about 20 for normalizing the normal and the diffuse term.
+ */
+static double
+vertWorkloadFlops(const VertWorkload *vw)
+{
+  return 28.0*vw->mats + 36.0*vw->bones + (vw->light ? 20.0 : 0.0);
+}
+
+/*
+ * The -vert workload. Every matrix is a uniform, set to the identity at
+ * run time, so the mesh still lands where the fixed-function transform
+ * puts it. The chain cycles through VERT_CHAIN_UNIFORMS matrices. There
+ * are no bone index/weight streams: each vertex picks its bones from a
+ * hash of its position and weights them equally, which costs the
+ * shader the same ALU work as real skinning, without the fetches.
+ */
+static GLchar *
+makeVertWorkloadSource(const VertWorkload *vw, int core)
+{
+  size_t size = 2048 + 96*(size_t)(vw->mats + vw->bones);
+  GLchar *src = (GLchar *)malloc(size);
+  size_t n = 0;
+  int k;
+
+  if (src == NULL)
+    {
+      fprintf(stderr, "Error: out of memory generating the -vert shader\n");
+      exit(1);
+    }
+  if (core)
+    shaderAppend(src, size, &n,
+                 "#version 330 core\n"
+                 "layout(std140) uniform Transform\n"
+                 "{\n"
+                 "    mat4 mvp;\n"
+                 "};\n"
+                 "in vec2 position;\n"
+                 "in vec4 color;\n"
+                 "in vec3 normal;\n"
+                 "out vec4 vColor;\n"
+                 "#define MVP mvp\n"
+                 "#define COLOR_IN color\n"
+                 "#define NORMAL_IN normal\n"
+                 "#define COLOR_OUT vColor\n");
+  else
+    shaderAppend(src, size, &n,
+                 "#version 110\n"
+                 "attribute vec2 position;\n"
+                 "#define MVP gl_ModelViewProjectionMatrix\n"
+                 "#define COLOR_IN gl_Color\n"
+                 "#define NORMAL_IN gl_Normal\n"
+                 "#define COLOR_OUT gl_FrontColor\n");
+  shaderAppend(src, size, &n,
+               "#define PALETTE %d.0\n"
+               "uniform mat4 chain[%d];\n"
+               "uniform mat4 palette[%d];\n"
+               "uniform vec3 lightDir;\n"
+               "void main()\n"
+               "{\n"
+               "    vec4 p = vec4(position, 0.0, 1.0);\n"
+               "    vec4 c = COLOR_IN;\n",
+               VERT_PALETTE_BONES, VERT_CHAIN_UNIFORMS, VERT_PALETTE_BONES);
+  if (vw->bones > 0)
+    {
+      shaderAppend(src, size, &n,
+                   "    float bone = floor(position.x) + 7.0*floor(position.y);\n"
+                   "    vec4 s = vec4(0.0);\n");
+      for (k=0;k<vw->bones;k++)
+        shaderAppend(src, size, &n,
+                     "    s += %f*(palette[int(mod(bone + %d.0, PALETTE))]*p);\n",
+                     1.0/vw->bones, 5*k);
+      shaderAppend(src, size, &n, "    p = s;\n");
+    }
+  for (k=0;k<vw->mats;k++)
+    shaderAppend(src, size, &n, "    p = chain[%d]*p;\n", k % VERT_CHAIN_UNIFORMS);
+  if (vw->light)
+    shaderAppend(src, size, &n,
+                 "    c.rgb *= 0.25 + 0.75*max(dot(normalize(NORMAL_IN), lightDir), 0.0);\n");
+  shaderAppend(src, size, &n,
+               "    COLOR_OUT = c;\n"
+               "    gl_Position = MVP*p;\n"
+               "}\n");
+  if (n >= size)
+    {
+      fprintf(stderr, "Error: the generated -vert shader overflowed its buffer\n");
+      exit(1);
+    }
+  return src;
+}
+
+static void
+setVertWorkloadUniforms(GLuint program)
+{
+  GLfloat identity[VERT_PALETTE_BONES*16];
+  int k;
+
+  memset(identity, 0, sizeof(identity));
+  for (k=0;k<VERT_PALETTE_BONES;k++)
+    identity[16*k] = identity[16*k+5] = identity[16*k+10] = identity[16*k+15] = 1.0F;
+  glUseProgram(program);
+  glUniformMatrix4fv(glGetUniformLocation(program, "chain"), VERT_CHAIN_UNIFORMS,
+                     GL_FALSE, identity);
+  glUniformMatrix4fv(glGetUniformLocation(program, "palette"), VERT_PALETTE_BONES,
+                     GL_FALSE, identity);
+  glUniform3f(glGetUniformLocation(program, "lightDir"), 0.267F, 0.535F, 0.802F);
+}
+
+static void
+setFragWorkloadUniforms(GLuint program, const FragWorkload *fw)
+{
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "loops"), fw->loops);
+  glUniform1i(glGetUniformLocation(program, "pick"), 0);
+  glUniform3f(glGetUniformLocation(program, "mulK"), 0.999F, 0.998F, 0.997F);
+  glUniform3f(glGetUniformLocation(program, "addK"), 0.001F, 0.002F, 0.003F);
+  glUniform1f(glGetUniformLocation(program, "sink"), 0.0F);
+}
+
+typedef struct
+{
+  GLuint vao, ubo;
+  float  sx, sy;              /* position units to NDC */
+  float  degrees;             /* accumulated rotation about the center */
+} CoreTransform;
+
+static void
+setupCoreTransform(CoreTransform *ct, int width, int height)
+{
+  glGenVertexArrays(1, &ct->vao);
+  glBindVertexArray(ct->vao);
+  glGenBuffers(1, &ct->ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, ct->ubo);
+  glBufferData(GL_UNIFORM_BUFFER, 16*sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, CORE_TRANSFORM_BINDING, ct->ubo);
+  ct->sx = 2.0F/width;
+  ct->sy = 2.0F/height;
+  ct->degrees = 0.0F;
+}
+
+/* translate(-1,-1) scale(sx,sy) translate(c) rotate translate(-c), column major */
+static void
+writeCoreTransform(const CoreTransform *ct, float cx, float cy)
+{
+  double a = ct->degrees*M_PI/180.0, c = cos(a), s = sin(a);
+  GLfloat m[16];
+
+  memset(m, 0, sizeof(m));
+  m[0] = (GLfloat)(ct->sx*c);
+  m[1] = (GLfloat)(ct->sy*s);
+  m[4] = (GLfloat)(-ct->sx*s);
+  m[5] = (GLfloat)(ct->sy*c);
+  m[10] = 1.0F;
+  m[12] = (GLfloat)(ct->sx*(cx - c*cx + s*cy) - 1.0);
+  m[13] = (GLfloat)(ct->sy*(cy - s*cx - c*cy) - 1.0);
+  m[15] = 1.0F;
+  /* nothing else binds GL_UNIFORM_BUFFER, the block's buffer stays bound */
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(m), m);
+}
+
+static void
+destroyCoreTransform(CoreTransform *ct)
+{
+  glBindVertexArray(0);
+  glDeleteVertexArrays(1, &ct->vao);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glDeleteBuffers(1, &ct->ubo);
+}
+
+void
+wesTriangleRateBenchmark(AppState *as)
+{
+  double startTime, endTime, frameStartTime;
+  double frameMean = 0.0, frameM2 = 0.0; /* running frame time stats */
+  int    converged = 0;
+  size_t totalTris=0, totalVerts=0;
+  float elapsedTimeSeconds;
+  SampleArray cpuFrameMs = {NULL, 0, 0}, gpuFrameNs = {NULL, 0, 0};
+  SampleArray frameSamples = {NULL, 0, 0};
+  QueryRing timerRing, fragmentRing;
+  GLuint runTimestamps[2];
+  int useGpuTimers = as->gpuTimers &&
+    (GLEW_VERSION_3_3 || GLEW_ARB_timer_query);
+  GLuint trianglesListIndx = 0;
+
+  int nFrames=0;
+
+  MeshEntry *mesh = NULL;
+  const char *meshSource = NULL;
+  StreamRing stream;
+  Uploader uploader;
+  CoreTransform core;
+  FetchArrays fetch;
+  TexturePass texPass;
+  Vertex2D *dispatchVerts = NULL;
+  void     *dispatchIndices = NULL;
+  GLenum   dispatchIndexType = 0; /* 0 means glDrawArrays */
+  GLenum   dispatchPrimitive = GL_TRIANGLES;
+  int dispatchVertexCount, dispatchTriangles, dispatchIndexCount = 0;
+  GLuint dispatchBuffers[5] = {0, 0, 0, 0, 0}; /* verts, colors, indices, normals, texcoords when -retained */
+  const GLvoid *drawIndices = NULL;
+  DrawBatches batches;
+  VertexLayout *layout;
+  double submitSeconds = 0.0, submitStart;
+
+  int screenWidth = as->imgWidth;
+  int screenHeight = as->imgHeight;
+  GLfloat cx = 0.5F*screenWidth, cy = 0.5F*screenHeight; /* rotation center */
+  double testDurationSeconds = as->testDurationSeconds;
+  size_t triangleLimit = as->triangleLimit;
+
+
+  /*
+   * Objective(s):
+   * 1. Want triangles with a specified area (e.g., 8sq pixels) for the
+   * purpose of generating a graphics load with reasonably precise
+   * characteristics .
+   * 2. Want triangles to *all* remain on-screen so that triangle rate
+   * reflects the cost of rendering visible triangles/fragments.
+   *
+   * Approach:
+   * 1. build a base mesh of vertices. This set of verts is positioned
+   * so that it will remain entirely within the view frustum no matter
+   * how we rotate it (in 2D). It spans half of the shorter window side,
+   * centered, so non-square -w/-h sizes still keep it on screen.
+   * 2. dispatch off the mesh vertices as disjoint triangles using
+   * vertex arrays. This approach is not the most efficient way to
+   * represent densely packed triangles, but has a couple of benefits:
+   * - It allows us to easily set the maximum number of triangles per
+   *   frame to be dispatched off to the renderer w/o having to resort
+   *   to tricks like inserting degenerate triangles in strips to connect
+   *   up two disjoint strips.
+   * - It allows us to glDrawArrays rather than glDrawElements. The latter
+   *   uses one level of indirection, and will be less efficient.
+   * - In the end, we care about vertex rate, not triangle rate.
+   *
+   * An early version of this code used the glDrawElements with indices.
+   * Rather than insert compile-time switches, this old code is simply
+   * cut-n-pasted and commented out at the end of this file.
+   */
+
+  /* Make sure we are drawing to the front buffer (or the FBO if headless) */
+  if (as->headless != 0)
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  else
+    glDrawBuffer(GL_FRONT);
+  glDisable(GL_DEPTH_TEST);
+
+  /* Clear the screen */
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  if (as->outlineMode != 0)
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+  else
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+  if (as->coreProfile)
+    {
+      /* the VAO has to be bound before any array or index buffer is */
+      setupCoreTransform(&core, screenWidth, screenHeight);
+    }
+  else
+    {
+      /* Load identities */
+      glMatrixMode( GL_PROJECTION );
+      glPushMatrix();
+      glLoadIdentity( );
+
+      glMatrixMode( GL_MODELVIEW );
+      glPushMatrix();
+      glLoadIdentity();
+
+      /* change range from -1..1 to 0..[screenWidth, screenHeight] */
+      glTranslatef(-1.0, -1.0, 0.0);
+      glScalef(2.0/screenWidth, 2.0/screenHeight, 1.0F);
+
+
+      glDisable(GL_LIGHTING);
+
+      glDisable(GL_TEXTURE_2D);
+    }
+
+  if (as->streamMode)
+    {
+      /* no mesh at all: every frame is generated into the ring as it's drawn */
+      setupStreamRing(&stream, as);
+      dispatchTriangles = (int)stream.frameTriangles;
+      dispatchVertexCount = (int)stream.frameTriangles*3;
+      as->computedVertsPerArrayCall = stream.chunkTriangles*3;
+      as->computedIndicesPerArrayCall = 0;
+      as->computedTransformedVertsPerFrame = stream.frameTriangles*3;
+      as->computedBytesPerVertex = sizeof(StreamVertex);
+      as->computedDrawsPerFrame = (int)stream.chunksPerFrame;
+      enableVertexArrays(1);
+    }
+  else
+    {
+      /* build the geometry, or pick it up from an earlier run */
+      mesh = acquireMesh(as, &meshSource);
+      dispatchVerts = mesh->dispatchVerts;
+      dispatchIndices = mesh->dispatchIndices;
+      dispatchIndexType = mesh->dispatchIndexType;
+      dispatchPrimitive = mesh->dispatchPrimitive;
+      dispatchVertexCount = mesh->dispatchVertexCount;
+      dispatchTriangles = mesh->dispatchTriangles;
+      dispatchIndexCount = mesh->dispatchIndexCount;
+      layout = &mesh->layout;
+      as->computedVertsPerArrayCall = mesh->vertsPerArrayCall;
+      as->computedIndicesPerArrayCall = mesh->indicesPerArrayCall;
+      as->computedTransformedVertsPerFrame = mesh->transformedVerts;
+      as->computedBytesPerVertex = positionFormats[as->positionFormat].bytes +
+        colorFormats[as->colorFormat].bytes;
+      if (as->positionFormat == POS_SHORT)
+        {
+          /* fixed point positions: scale back to pixels, and rotate about
+             the center expressed in the same units */
+          if (as->coreProfile)
+            {
+              core.sx /= layout->positionScale;
+              core.sy /= layout->positionScale;
+            }
+          else
+            glScalef(1.0F/layout->positionScale, 1.0F/layout->positionScale, 1.0F);
+          cx *= layout->positionScale;
+          cy *= layout->positionScale;
+        }
+
+      /* Set up the pointers */
+      if (as->retainedMode != 0)
+        {
+          /*
+           * retained mode: copy the dispatch arrays into buffer objects once,
+           * here, so the per-frame glDrawArrays only names GPU-resident data
+           * rather than having the driver pull the client arrays every frame.
+           * The buffers stay with the cached mesh, so later runs with the
+           * same usage skip the upload.
+           */
+          int k;
+
+          if (mesh->buffers[0] == 0 || mesh->bufferUsage != as->bufferUsage)
+            {
+              if (mesh->buffers[0] == 0)
+                glGenBuffers(5, mesh->buffers);
+              mesh->bufferUsage = as->bufferUsage;
+              mesh->gpuBytes = 0;
+
+              for (k=0;k<layout->nStreams;k++)
+                {
+                  glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[k]);
+                  glBufferData(GL_ARRAY_BUFFER, layout->streamBytes[k],
+                               layout->streams[k], as->bufferUsage);
+                  mesh->gpuBytes += layout->streamBytes[k];
+                }
+              if (dispatchIndexType != 0)
+                {
+                  size_t indexBytes = (dispatchIndexType == GL_UNSIGNED_SHORT ? 2 : 4)*(size_t)dispatchIndexCount;
+
+                  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->buffers[2]);
+                  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes,
+                               dispatchIndices, as->bufferUsage);
+                  mesh->gpuBytes += indexBytes;
+                }
+              if (mesh->dispatchNormals != NULL)
+                {
+                  size_t normalBytes = sizeof(Vertex3D)*(size_t)dispatchVertexCount;
+
+                  glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[3]);
+                  glBufferData(GL_ARRAY_BUFFER, normalBytes,
+                               mesh->dispatchNormals, as->bufferUsage);
+                  mesh->gpuBytes += normalBytes;
+                }
+              if (mesh->dispatchTCs != NULL)
+                {
+                  size_t tcBytes = sizeof(Vertex2D)*(size_t)dispatchVertexCount;
+
+                  glBindBuffer(GL_ARRAY_BUFFER, mesh->buffers[4]);
+                  glBufferData(GL_ARRAY_BUFFER, tcBytes,
+                               mesh->dispatchTCs, as->bufferUsage);
+                  mesh->gpuBytes += tcBytes;
+                }
+            }
+          memcpy(dispatchBuffers, mesh->buffers, sizeof(dispatchBuffers));
+          bindVertexLayout(layout, dispatchBuffers);
+
+          drawIndices = (const GLvoid *)0;
+          if (dispatchIndexType != 0)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dispatchBuffers[2]);
+        }
+      else
+        {
+          bindVertexLayout(layout, NULL);
+          drawIndices = (const GLvoid *)dispatchIndices;
+        }
+      enableVertexArrays(1);
+      if (as->fetchAttribs > 0)
+        as->computedBytesPerVertex =
+          setupFetchArrays(&fetch, as, mesh, dispatchBuffers, layout);
+      else if (as->texMode)
+        setupTexturePass(&texPass, as, mesh, dispatchBuffers);
+      else if (mesh->dispatchNormals != NULL)
+        bindNormals(mesh->dispatchNormals, dispatchBuffers[3], 1);
+
+      if (as->submitMode != SUBMIT_SINGLE_DRAW)
+        {
+          setupDrawBatches(&batches, as->submitMode, as->vertexBufLimit,
+                           dispatchVertexCount, dispatchVerts,
+                           dispatchBuffers[0], dispatchBuffers[1]);
+          dispatchTriangles = drawBatchesTriangles(&batches, dispatchTriangles);
+          as->computedTransformedVertsPerFrame = (size_t)dispatchTriangles*3;
+          as->computedDrawsPerFrame = batches.nDraws;
+        }
+      else
+        as->computedDrawsPerFrame = 1;
+
+      if (as->uploadMode != UPLOAD_NONE)
+        {
+          if (!uploadModeSupported(as->uploadMode))
+            {
+              fprintf(stderr, "Error: upload strategy %s isn't supported by this GL\n",
+                      uploadModeNames[as->uploadMode]);
+              exit(1);
+            }
+          setupUploader(&uploader, as->uploadMode, as->uploadFramesInFlight,
+                        dispatchVerts, dispatchVertexCount, cx, cy);
+        }
+    }
+
+  if (as->coreProfile)
+    writeCoreTransform(&core, cx, cy);
+
+  glFinish();                 /* make sure all setup is finished */
+
+  if (useGpuTimers)
+    {
+      queryRingInit(&timerRing, GL_TIME_ELAPSED, &gpuFrameNs);
+      glGenQueries(2, runTimestamps);
+      glQueryCounter(runTimestamps[0], GL_TIMESTAMP);
+    }
+
+  /*
+   * the area estimate is wrong for outlines, clipped triangles and the
+   * rotating mesh, so optionally count what the rasterizer actually
+   * produced. Without multisampling, samples passed == fragments.
+   */
+  if (as->countFragments)
+    queryRingInit(&fragmentRing, GL_SAMPLES_PASSED, &frameSamples);
+
+  startTime = endTime = frameStartTime = wesGetTime();
+
+   if (SCREENSHOT_MODE == 1) {
+        /* Clear the screen */
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClear(GL_COLOR_BUFFER_BIT);
+        dispatchDraw(dispatchPrimitive, dispatchVertexCount,
+                     dispatchIndexType, dispatchIndexCount, drawIndices);
+        dispatchDraw(dispatchPrimitive, dispatchVertexCount,
+                     dispatchIndexType, dispatchIndexCount, drawIndices);
+        fprintf(stderr," You have screenshot mode enabled! \n");
+        fflush(stderr);
+        sleep(5);
+   } else {
+      while (!converged &&
+             (myAppState.limitByFrames == 1 ?
+              nFrames < myAppState.nFramesLimit :
+              (endTime - startTime) < testDurationSeconds))
+        {
+          if (useGpuTimers)
+            queryRingBegin(&timerRing);
+          if (as->countFragments)
+            queryRingBegin(&fragmentRing);
+
+          if (as->uploadMode != UPLOAD_NONE)
+            uploadFrame(&uploader);
+
+          submitStart = wesGetTime();
+          if (as->streamMode)
+            submitStreamFrame(&stream);
+          else if (as->submitMode == SUBMIT_SINGLE_DRAW)
+            dispatchDraw(dispatchPrimitive, dispatchVertexCount,
+                         dispatchIndexType, dispatchIndexCount, drawIndices);
+          else
+            submitDrawBatches(&batches);
+          submitSeconds += wesGetTime() - submitStart;
+
+          if (as->countFragments)
+            {
+              queryRingEnd(&fragmentRing);
+              queryRingRetire(&fragmentRing, 0);
+            }
+          if (useGpuTimers)
+            {
+              queryRingEnd(&timerRing);
+              queryRingRetire(&timerRing, 0);
+            }
+
+          if (as->uploadMode != UPLOAD_NONE)
+            uploadFrameDone(&uploader);
+          else if (as->coreProfile)
+            {
+              core.degrees += 0.01F;
+              writeCoreTransform(&core, cx, cy);
+            }
+          else
+            {
+              glTranslatef(cx, cy, 0.0F);
+              glRotatef(0.01F, 0.0F, 0.0F, 1.0F);
+              glTranslatef(-cx, -cy, 0.0F);
+            }
+
+          endTime = wesGetTime();
+          sampleArrayPush(&cpuFrameMs, (endTime - frameStartTime)*1000.0);
+          frameStartTime = endTime;
+
+          nFrames++;
+          totalTris += dispatchTriangles;
+          totalVerts += as->computedTransformedVertsPerFrame;
+
+          /*
+           * sweep points don't need the full duration: stop once the 95%
+           * confidence interval of the mean frame time is tight enough.
+           */
+          if (as->earlyStop && as->ciTolerance > 0.0)
+            {
+              double x = cpuFrameMs.v[cpuFrameMs.n-1];
+              double delta = x - frameMean;
+              frameMean += delta/nFrames;
+              frameM2 += delta*(x - frameMean);
+              if (nFrames >= SWEEP_MIN_FRAMES &&
+                  1.96*sqrt(frameM2/(nFrames-1)/nFrames) < as->ciTolerance*frameMean)
+                converged = 1;
+            }
+        }
+  }
+
+  if (useGpuTimers)
+    glQueryCounter(runTimestamps[1], GL_TIMESTAMP);
+
+  glFinish();
+  endTime = wesGetTime();
+
+  if (as->uploadMode != UPLOAD_NONE)
+    destroyUploader(&uploader);
+  if (as->streamMode)
+    destroyStreamRing(&stream);
+  else if (as->submitMode != SUBMIT_SINGLE_DRAW)
+    destroyDrawBatches(&batches);
+
+  if (!as->coreProfile)
+    {
+      /* Restore the gl stack */
+      glMatrixMode( GL_MODELVIEW );
+      glPopMatrix();
+
+      glMatrixMode( GL_PROJECTION );
+      glPopMatrix();
+    }
+
+  enableVertexArrays(0);
+  if (as->fetchAttribs > 0)
+    destroyFetchArrays(&fetch);
+  else if (as->texMode)
+    destroyTexturePass(&texPass);
+  else if (mesh != NULL && mesh->dispatchNormals != NULL)
+    bindNormals(NULL, 0, 0);
+  if (as->retainedMode != 0)
+    {
+      /* the buffers belong to the cached mesh, just unbind them */
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+  if (as->coreProfile)
+    destroyCoreTransform(&core);
+
+  /* Before printing the results, make sure we didn't have
+  ** any GL related errors. */
+  check_gl_errors();
+
+  /* the pause that refreshes -- */
+#ifdef _WIN32
+  Sleep(250);
+#else
+  usleep(250000);
+#endif
+
+  elapsedTimeSeconds = endTime - startTime;
+  as->computedMTrisPerSecond = ((totalTris)/1000000.0f)/elapsedTimeSeconds;
+  as->computedMVertexOpsPerSecond = ((totalVerts) / 1000000.0f) / elapsedTimeSeconds;
+  as->computedFPS = (nFrames + 1.0f) / elapsedTimeSeconds;
+  as->computedFrames = nFrames;
+  as->computedDrawsPerSecond = (double)nFrames*as->computedDrawsPerFrame/elapsedTimeSeconds;
+  as->computedCpuNsPerDraw = nFrames ?
+    submitSeconds*1.0e9/((double)nFrames*as->computedDrawsPerFrame) : 0.0;
+  as->computedMFragsPerSecond = as->computedMTrisPerSecond*as->triangleAreaInPixels;
+  as->computedMeasuredMFragsPerSecond = 0.0f;
+  as->computedFragsPerFrame = 0.0;
+  if (as->countFragments)
+    {
+      double totalFrags = 0.0;
+      size_t k;
+
+      queryRingDestroy(&fragmentRing);
+      for (k=0;k<frameSamples.n;k++)
+        totalFrags += frameSamples.v[k];
+      as->computedMeasuredMFragsPerSecond = (totalFrags/1000000.0)/elapsedTimeSeconds;
+      as->computedFragsPerFrame = frameSamples.n ? totalFrags/frameSamples.n : 0.0;
+      printf("Fragments:\t%.0f/frame measured, %.0f/frame estimated (%zu ring stalls)\n",
+             as->computedFragsPerFrame,
+             (double)dispatchTriangles*as->triangleAreaInPixels,
+             fragmentRing.stalls);
+      sampleArrayFree(&frameSamples);
+    }
+  if (as->fragWorkloadMode)
+    {
+      /* measured fragments when we have them, the estimate otherwise */
+      double mfrags = as->countFragments ?
+        as->computedMeasuredMFragsPerSecond : as->computedMFragsPerSecond;
+
+      as->computedFragGFlopsPerSecond = mfrags*fragWorkloadFlops(&as->fragWorkload)/1000.0;
+      as->computedNsPerFragment = mfrags > 0.0 ? 1000.0/mfrags : 0.0;
+      printf("Fragment ALU:\t%d loops x %d ops (%d chains, %d sin, %s branch), %.0f flops/frag, %.3f GFLOP/s, %.3f ns/frag\n",
+             as->fragWorkload.loops, as->fragWorkload.ops, as->fragWorkload.chains,
+             as->fragWorkload.trans, branchModeNames[as->fragWorkload.branch],
+             fragWorkloadFlops(&as->fragWorkload),
+             as->computedFragGFlopsPerSecond, as->computedNsPerFragment);
+    }
+
+  if (as->fetchAttribs > 0)
+    {
+      as->computedFetchGBPerSecond =
+        as->computedMVertexOpsPerSecond*as->computedBytesPerVertex/1000.0;
+      printf("Attribute fetch:\t%d attributes (%d floats per extra), %zu bytes/vert, %.3f Mverts/sec, %.3f GB/s\n",
+             as->fetchAttribs, as->fetchWidth, as->computedBytesPerVertex,
+             as->computedMVertexOpsPerSecond, as->computedFetchGBPerSecond);
+    }
+  if (as->texMode)
+    {
+      double mfrags = as->countFragments ?
+        as->computedMeasuredMFragsPerSecond : as->computedMFragsPerSecond;
+      double fragsPerFrame = as->countFragments ?
+        as->computedFragsPerFrame : (double)dispatchTriangles*as->triangleAreaInPixels;
+
+      as->computedGTexelsPerSecond = mfrags*texPass.taps/1000.0;
+      as->computedTexWorkingSetMB =
+        texPass.workingSetTexels*texFormats[as->texFormat].bytes/(1024.0*1024.0);
+      as->computedTexReuse = texPass.workingSetTexels > 0.0 ?
+        fragsPerFrame*texPass.taps/texPass.workingSetTexels : 0.0;
+      printf("Texture:\t%dx%d %s, %s x%d aniso, %s access: %.3f Msamples/sec, %.3f Gtexels/sec\n",
+             as->texSize, as->texSize, texFormats[as->texFormat].name,
+             texFilterNames[as->texFilter], as->texAniso, texAccessNames[as->texAccess],
+             mfrags, as->computedGTexelsPerSecond);
+      printf("Texture cache:\t%.2f MB touched/frame, each texel fetched %.1fx, hit rate <= %.1f%%\n",
+             as->computedTexWorkingSetMB, as->computedTexReuse,
+             as->computedTexReuse > 1.0 ? 100.0*(1.0 - 1.0/as->computedTexReuse) : 0.0);
+    }
+  if (as->vertWorkloadMode)
+    {
+      as->computedVertGFlopsPerSecond =
+        as->computedMVertexOpsPerSecond*vertWorkloadFlops(&as->vertWorkload)/1000.0;
+      printf("Vertex ALU:\t%d mats, %d bones, lighting %s, ~%.0f flops/vert, %.3f Mverts/sec, %.3f GFLOP/s\n",
+             as->vertWorkload.mats, as->vertWorkload.bones, as->vertWorkload.light ? "on" : "off",
+             vertWorkloadFlops(&as->vertWorkload), as->computedMVertexOpsPerSecond,
+             as->computedVertGFlopsPerSecond);
+    }
+
+  printf("verts/frame = %d \n", dispatchVertexCount);
+  printf("nframes = %d %s\n", nFrames, converged ? "(stopped early, CI converged)" : "");
+  printf("Elapsed time:\t%f(s)\n ", elapsedTimeSeconds);
+  printf("Dispatched Triangles Per Frame: %d \n", dispatchTriangles);
+  printf("Vertex format:\t%s position, %s color, %s, %zu bytes/vert\n",
+         positionFormats[as->positionFormat].name,
+         colorFormats[as->colorFormat].name,
+         as->interleaved ? "interleaved" : "separate arrays",
+         as->computedBytesPerVertex);
+  printf("Draws:\t%d/frame (%s), %.0f draws/sec, %.1f CPU ns/draw\n",
+         as->computedDrawsPerFrame, submitModeNames[as->submitMode],
+         as->computedDrawsPerSecond, as->computedCpuNsPerDraw);
+
+  /* frame time distribution: GPU execution time when we have it */
+  {
+    double cpuP[4], gpuP[4];
+    size_t k;
+
+    samplePercentiles(&cpuFrameMs, cpuP);
+    printf("CPU frame ms:\tp50 %.4f  p90 %.4f  p99 %.4f  max %.4f\n",
+           cpuP[0], cpuP[1], cpuP[2], cpuP[3]);
+    memcpy(as->computedFrameMs, cpuP, sizeof(cpuP));
+    as->computedFrameMsFromGPU = 0;
+
+    if (useGpuTimers)
+      {
+        GLuint64 t0, t1;
+
+        queryRingDestroy(&timerRing);
+        glGetQueryObjectui64v(runTimestamps[0], GL_QUERY_RESULT, &t0);
+        glGetQueryObjectui64v(runTimestamps[1], GL_QUERY_RESULT, &t1);
+        glDeleteQueries(2, runTimestamps);
+
+        for (k=0;k<gpuFrameNs.n;k++)
+          gpuFrameNs.v[k] *= 1.0e-6; /* ns -> ms */
+        samplePercentiles(&gpuFrameNs, gpuP);
+        printf("GPU frame ms:\tp50 %.4f  p90 %.4f  p99 %.4f  max %.4f  (%zu ring stalls, GPU span %f(s))\n",
+               gpuP[0], gpuP[1], gpuP[2], gpuP[3], timerRing.stalls,
+               (double)(t1 - t0)*1.0e-9);
+        memcpy(as->computedFrameMs, gpuP, sizeof(gpuP));
+        as->computedFrameMsFromGPU = 1;
+        printSampleHistogram("GPU", &gpuFrameNs);
+      }
+    else
+      printSampleHistogram("CPU", &cpuFrameMs);
+
+    sampleArrayFree(&cpuFrameMs);
+    sampleArrayFree(&gpuFrameNs);
+  }
+  if (dispatchIndexType != 0)
+    printf("indices/frame = %d (%d bit)\n", dispatchIndexCount,
+           dispatchIndexType == GL_UNSIGNED_SHORT ? 16 : 32);
+  printf("Vertex reuse:\t%zu transformed verts/frame, %.3f verts/tri, %.1f%% post-transform cache hits\n",
+         as->computedTransformedVertsPerFrame,
+         (double)as->computedTransformedVertsPerFrame/dispatchTriangles,
+         dispatchIndexType ?
+         100.0*(1.0 - (double)as->computedTransformedVertsPerFrame/dispatchIndexCount) : 0.0);
+
+  as->computedUploadGBPerSecond = 0.0;
+  as->computedUploadStallMsPerFrame = 0.0;
+  if (as->uploadMode != UPLOAD_NONE)
+    {
+      as->computedUploadGBPerSecond = uploader.bytesUploaded/elapsedTimeSeconds*1.0e-9;
+      as->computedUploadStallMsPerFrame = nFrames ?
+        (uploader.callSeconds + uploader.ring.waitSeconds)*1000.0/nFrames : 0.0;
+      printf("Upload:\t\t%s, %.1f MB/frame, %.2f GB/s, per frame %.3f ms in upload calls, %.3f ms on fences, %.3f ms rotating (%d regions)\n",
+             uploadModeNames[as->uploadMode], uploader.bytes/(1024.0*1024.0),
+             as->computedUploadGBPerSecond,
+             nFrames ? uploader.callSeconds*1000.0/nFrames : 0.0,
+             nFrames ? uploader.ring.waitSeconds*1000.0/nFrames : 0.0,
+             nFrames ? uploader.rotateSeconds*1000.0/nFrames : 0.0,
+             uploader.ring.nRegions);
+    }
+
+  as->computedStreamGBPerSecond = 0.0;
+  as->computedStreamStallPercent = 0.0;
+  if (as->streamMode)
+    {
+      as->computedStreamGBPerSecond = stream.bytesGenerated/elapsedTimeSeconds*1.0e-9;
+      as->computedStreamStallPercent = 100.0*stream.stallSeconds/elapsedTimeSeconds;
+      printf("Streaming:\t%zu tris/frame in %zu chunks of %zu, %.1f MB ring, %.2f GB/s generated (%.2f s on the worker), %.3f s waiting on the ring\n",
+             stream.frameTriangles, stream.chunksPerFrame, stream.chunkTriangles,
+             STREAM_RING_CHUNKS*stream.chunkTriangles*3*sizeof(StreamVertex)/(1024.0*1024.0),
+             as->computedStreamGBPerSecond, stream.generateSeconds, stream.stallSeconds);
+    }
+  else
+    printf("Mesh:\t\t%s, %.1f MB (%.3f s to set up)\n",
+           meshSource,
+           meshEntryBytes(mesh)/(1024.0*1024.0), mesh->buildSeconds);
+
+  /* keep the mesh for later runs as long as the cache budget allows */
+  meshCacheTrim((size_t)as->meshCacheMB << 20);
+
+  printf("Mesh cache:\t%d meshes in %.1f MB (%zu hits, %zu misses)\n",
+         meshCache.nEntries, meshCacheBytes()/(1024.0*1024.0),
+         meshCache.hits, meshCache.misses);
+  printf("Mesh memory:\t%.1f MB peak, %.1f MB mapped (%.1f MB huge page advised, %.1f MB locked, %.1f MB spare)\n",
+         arenaPool.peak/(1024.0*1024.0), arenaPool.mapped/(1024.0*1024.0),
+         arenaPool.hugeAdvised/(1024.0*1024.0), arenaPool.locked/(1024.0*1024.0),
+         arenaPool.spareBytes/(1024.0*1024.0));
+  as->computedMeshPeakMB = arenaPool.peak/(1024.0*1024.0);
+}
+
+
+/* A simple routine which checks for GL errors. */
+void check_gl_errors (void) {
+  GLenum err;
+  err = glGetError();
+  if (err != GL_NO_ERROR) {
+    fprintf (stderr, "GL Error: ");
+    switch (err) {
+    case GL_INVALID_ENUM:
+      fprintf (stderr, "Invalid Enum\n");
+      break;
+    case GL_INVALID_VALUE:
+      fprintf (stderr, "Invalid Value\n");
+      break;
+    case GL_INVALID_OPERATION:
+      fprintf (stderr, "Invalid Operation\n");
+      break;
+    case GL_STACK_OVERFLOW:
+      fprintf (stderr, "Stack Overflow\n");
+      break;
+    case GL_STACK_UNDERFLOW:
+      fprintf (stderr, "Stack Underflow\n");
+      break;
+    case GL_OUT_OF_MEMORY:
+      fprintf (stderr, "Out of Memory\n");
+      break;
+    default:
+      fprintf (stderr, "Unknown\n");
+    }
+    exit(1);
+  }
+}
+
+void Init (void) {
+  /* Init does nothing */
+}
+
+void Reshape (int x, int y) {
+  /* Reshape does nothing */
+  (void) x;
+  (void) y;
+}
+
+
+void Key(unsigned char a, int x, int y) {
+  /* Key does nothing */
+  (void) x;
+  (void) y;
+  (void) a;
+}
+
+static void error_callback(int error, const char* description)
+{
+  fprintf(stderr, "Error: %s\n", description);
+}
+
+static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+  if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+}
+
 
-  dv = *dispatchVerts = (Vertex2D *)malloc(sizeof(Vertex2D)*(*dispatchTriangles)*3);
-  dc = *dispatchColors = (Color3D *)malloc(sizeof(Color3D)*(*dispatchTriangles)*3);
-  dn = *dispatchNormals = (Vertex3D *)malloc(sizeof(Vertex3D)*(*dispatchTriangles)*3);
-  dtc = *dispatchTCs = (Vertex2D *)malloc(sizeof(Vertex2D)*(*dispatchTriangles)*3);
+#if WESBENCH_HEADLESS
+static EGLDisplay headlessDisplay = EGL_NO_DISPLAY;
+static EGLContext headlessContext = EGL_NO_CONTEXT;
+static EGLConfig headlessConfig;
+static const EGLint *headlessContextAttribs;
 
-  dIndx = 0;
-  for (j=0;j<nVertsPerAxis;j++)
+/*
+ * Create a GL context with no window system surface. Mesa's surfaceless
+ * platform works without any display server or GPU device (llvmpipe),
+ * which is what the render-farm and CI nodes have.
+ */
+static int
+initHeadlessContext(const AppState *as)
+{
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+  const char *clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  EGLint major, minor, nConfigs;
+  static const EGLint configAttribs[] =
     {
-      for (i=0;i<nVertsPerAxis;i++)
-        {
-          /* for each mesh quad, copy over verts for two triangles */
-          sIndx = j*(nVertsPerAxis+1) + i;
-
-          /* triangle 0 */
-          dv[dIndx] = baseVerts[sIndx];
-          dc[dIndx] = baseColors[sIndx];
-          dn[dIndx] = baseNormals[sIndx];
-          dtc[dIndx] = baseTCs[sIndx];
-          dIndx++;
+      /* surfaceless configs only advertise pbuffer support, and
+         eglChooseConfig would otherwise insist on EGL_WINDOW_BIT */
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+    };
+  static const EGLint contextAttribs[] =
+    {
+      EGL_CONTEXT_MAJOR_VERSION, 2,
+      EGL_CONTEXT_MINOR_VERSION, 0,
+      EGL_NONE
+    };
+  static const EGLint coreContextAttribs[] =
+    {
+      EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE
+    };
+
+  getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay != NULL && clientExts != NULL &&
+      strstr(clientExts, "EGL_MESA_platform_surfaceless") != NULL)
+    headlessDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                         EGL_DEFAULT_DISPLAY, NULL);
+  if (headlessDisplay == EGL_NO_DISPLAY)
+    headlessDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  if (headlessDisplay == EGL_NO_DISPLAY ||
+      !eglInitialize(headlessDisplay, &major, &minor))
+    {
+      fprintf(stderr, "Error: unable to initialize an EGL display\n");
+      return 0;
+    }
 
-          dv[dIndx] = baseVerts[sIndx+1];
-          dc[dIndx] = baseColors[sIndx+1];
-          dn[dIndx] = baseNormals[sIndx+1];
-          dtc[dIndx] = baseTCs[sIndx+1];
-          dIndx++;
+  if (!eglBindAPI(EGL_OPENGL_API) ||
+      !eglChooseConfig(headlessDisplay, configAttribs, &headlessConfig, 1, &nConfigs) ||
+      nConfigs < 1)
+    {
+      fprintf(stderr, "Error: no EGL config supports desktop OpenGL\n");
+      return 0;
+    }
 
-          dv[dIndx] = baseVerts[sIndx+nVertsPerAxis+1];
-          dc[dIndx] = baseColors[sIndx+nVertsPerAxis+1];
-          dn[dIndx] = baseNormals[sIndx+nVertsPerAxis+1];
-          dtc[dIndx] = baseTCs[sIndx+nVertsPerAxis+1];
-          dIndx++;
+  headlessContextAttribs = as->coreProfile ? coreContextAttribs : contextAttribs;
+  headlessContext = eglCreateContext(headlessDisplay, headlessConfig, EGL_NO_CONTEXT,
+                                     headlessContextAttribs);
+  if (headlessContext == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(headlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      headlessContext))
+    {
+      fprintf(stderr, "Error: unable to make a surfaceless EGL context current\n");
+      return 0;
+    }
+  return 1;
+}
 
-          /* triangle 1 */
-          dv[dIndx] = baseVerts[sIndx+nVertsPerAxis+1];
-          dc[dIndx] = baseColors[sIndx+nVertsPerAxis+1];
-          dn[dIndx] = baseNormals[sIndx+nVertsPerAxis+1];
-          dtc[dIndx] = baseTCs[sIndx+nVertsPerAxis+1];
-          dIndx++;
+/* the offscreen render target that stands in for the window */
+static int
+initHeadlessFramebuffer(AppState *as)
+{
+  glGenRenderbuffers(1, &as->headlessColorRB);
+  glBindRenderbuffer(GL_RENDERBUFFER, as->headlessColorRB);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, as->imgWidth, as->imgHeight);
 
-          dv[dIndx] = baseVerts[sIndx+1];
-          dc[dIndx] = baseColors[sIndx+1];
-          dn[dIndx] = baseNormals[sIndx+1];
-          dtc[dIndx] = baseTCs[sIndx+1];
-          dIndx++;
+  glGenFramebuffers(1, &as->headlessFBO);
+  glBindFramebuffer(GL_FRAMEBUFFER, as->headlessFBO);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, as->headlessColorRB);
 
-          dv[dIndx] = baseVerts[sIndx+1+nVertsPerAxis+1];
-          dc[dIndx] = baseColors[sIndx+1+nVertsPerAxis+1];
-          dn[dIndx] = baseNormals[sIndx+1+nVertsPerAxis+1];
-          dtc[dIndx] = baseTCs[sIndx+1+nVertsPerAxis+1];
-          dIndx++;
-        }
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      fprintf(stderr, "Error: %dx%d offscreen framebuffer is incomplete\n",
+              as->imgWidth, as->imgHeight);
+      return 0;
     }
 
-  /*
-   * now we have a big pile of disjoint triangles. how many do we
-   * actually send down with each call?
-   */
-  if (*dispatchTriangles < triangleLimit)
-    *dispatchVertexCount = *dispatchTriangles*3;
-  else
-    *dispatchVertexCount = triangleLimit*3;
-  *dispatchTriangles = *dispatchVertexCount/3;
+  /* a surfaceless context starts out with an empty viewport */
+  glViewport(0, 0, as->imgWidth, as->imgHeight);
+  return 1;
 }
 
-
-void
-buildBaseArrays(float triangleAreaPixels,
-                int screenWidth,
-                int screenHeight,
-                int *nVertsPerAxis,
-                Vertex2D **baseVerts,
-                Color3D **baseColors,
-                Vertex3D **baseNormals,
-                Vertex2D **baseTCs)
+static void
+shutdownHeadless(AppState *as)
 {
-  /* construct base arrays for qmesh */
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &as->headlessFBO);
+  glDeleteRenderbuffers(1, &as->headlessColorRB);
+  eglMakeCurrent(headlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(headlessDisplay, headlessContext);
+  eglTerminate(headlessDisplay);
+}
+#endif
 
-  int usablePixels = screenWidth >> 1;
-  int i,j, indx=0;
-  float x, y;
-  float r, g, dr, dg;
-  float s, ds, t, dt;
-  Vertex2D *bv, *btc;
-  Vertex3D *bn;
-  Color3D *bc;
+/*
+ * Extra contexts in the benchmark context's share group, for worker
+ * threads: surfaceless EGL contexts when headless, hidden 1x1 windows
+ * otherwise. Create and destroy them on the main thread.
+ */
+typedef struct
+{
+#if WESBENCH_HEADLESS
+  EGLContext egl;
+#endif
+  GLFWwindow *window;
+} SharedContext;
 
-  /*
-   * we're going to construct a mesh that has vertex spacing
-   * at an interval such that each mesh quad will have two
-   * triangles whose area sums to triangleAreaPixels*2.
-   */
-  double spacing = sqrt(triangleAreaPixels*2.0);
-  *nVertsPerAxis = (int)((double)usablePixels/spacing);
+static int
+createSharedContext(SharedContext *sc, const AppState *as)
+{
+  sc->window = NULL;
+#if WESBENCH_HEADLESS
+  sc->egl = EGL_NO_CONTEXT;
+  if (as->headless != 0)
+    {
+      sc->egl = eglCreateContext(headlessDisplay, headlessConfig, headlessContext,
+                                 headlessContextAttribs);
+      return sc->egl != EGL_NO_CONTEXT;
+    }
+#endif
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  sc->window = glfwCreateWindow(1, 1, "shared", NULL, as->window);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+  return sc->window != NULL;
+}
 
-  bv = *baseVerts = (Vertex2D *)malloc(sizeof(Vertex2D)*(*nVertsPerAxis+1)*(*nVertsPerAxis+1));
-  bc = *baseColors = (Color3D *)malloc(sizeof(Color3D)*(*nVertsPerAxis+1)*(*nVertsPerAxis+1));
-  bn = *baseNormals = (Vertex3D *)malloc(sizeof(Vertex3D)*(*nVertsPerAxis+1)*(*nVertsPerAxis+1));
-  btc = *baseTCs = (Vertex2D *)malloc(sizeof(Vertex2D)*(*nVertsPerAxis+1)*(*nVertsPerAxis+1));
+/* called on the worker thread, to take the context (1) or let it go (0) */
+static void
+bindSharedContext(SharedContext *sc, int current)
+{
+#if WESBENCH_HEADLESS
+  if (sc->egl != EGL_NO_CONTEXT)
+    {
+      eglMakeCurrent(headlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                     current ? sc->egl : EGL_NO_CONTEXT);
+      return;
+    }
+#endif
+  glfwMakeContextCurrent(current ? sc->window : NULL);
+}
 
-  y= 0.25F * screenWidth;
-  g = 0.0F;
+static void
+destroySharedContext(SharedContext *sc)
+{
+#if WESBENCH_HEADLESS
+  if (sc->egl != EGL_NO_CONTEXT)
+    eglDestroyContext(headlessDisplay, sc->egl);
+#endif
+  if (sc->window != NULL)
+    glfwDestroyWindow(sc->window);
+}
 
-  dg = dr = 1.0F/(float)*nVertsPerAxis;
+/* the program every run draws with: -core, -frag and -vert decide which */
+static GLuint
+makeBenchmarkProgram(const AppState *as)
+{
+  GLuint program;
+
+  if (as->coreProfile) {
+      GLchar *vs = as->texMode ? makeTextureSource(GL_VERTEX_SHADER, 1) :
+          as->fetchAttribs > 0 ?
+          makeFetchSource(as->fetchAttribs, as->fetchWidth, 1) :
+          as->vertWorkloadMode ? makeVertWorkloadSource(&as->vertWorkload, 1) : NULL;
+      GLchar *fs = as->texMode ? makeTextureSource(GL_FRAGMENT_SHADER, 1) :
+          as->fragWorkloadMode ?
+          makeFragWorkloadSource(&as->fragWorkload, 1) : NULL;
+
+      program = make_program_source(vs ? vs : coreVertexSource, fs ? fs : coreFragmentSource,
+                                    fetchAttribNames, "core profile");
+      free(vs);
+      free(fs);
+      if (program == 0)
+          exit(EXIT_FAILURE);
+      glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Transform"),
+                            CORE_TRANSFORM_BINDING);
+  } else {
+      GLchar *vs = NULL, *fs = NULL;
+      GLint length;
+
+      if (as->texMode) {
+          vs = makeTextureSource(GL_VERTEX_SHADER, 0);
+          fs = makeTextureSource(GL_FRAGMENT_SHADER, 0);
+      } else {
+          if (as->fragWorkloadMode) {
+              printf("using generated frag shader\n");
+              fs = makeFragWorkloadSource(&as->fragWorkload, 0);
+          } else if (as->useFragShader == 1) {
+              printf("using frag shader\n");
+              fs = file_contents("hello-gl.f.glsl", &length);
+              if (fs == NULL)
+                  exit(EXIT_FAILURE);
+          }
+
+          if (as->fetchAttribs > 0) {
+              vs = makeFetchSource(as->fetchAttribs, as->fetchWidth, 0);
+          } else if (as->vertWorkloadMode) {
+              printf("using generated vert shader\n");
+              vs = makeVertWorkloadSource(&as->vertWorkload, 0);
+          } else if (as->useVertShader == 1) {
+              printf("using vert shader\n");
+              vs = file_contents("hello-gl.v.glsl", &length);
+              if (vs == NULL)
+                  exit(EXIT_FAILURE);
+          }
+      }
 
-  t = 0.0F;
-  dt = ds = 1.0/(float)*nVertsPerAxis;
+      /*
+       * A missing stage stays fixed function. Generic attribute 0
+       * aliases the glVertexPointer array, so "position" goes there.
+       */
+      program = make_program_source(vs, fs, fetchAttribNames, "compatibility");
+      free(vs);
+      free(fs);
+      if (program == 0)
+          exit(EXIT_FAILURE);
+  }
+  if (as->fragWorkloadMode)
+      setFragWorkloadUniforms(program, &as->fragWorkload);
+  if (as->vertWorkloadMode)
+      setVertWorkloadUniforms(program);
+  if (as->fetchAttribs > 0) {
+      glUseProgram(program);
+      glUniform1f(glGetUniformLocation(program, "sink"), 0.0F);
+  }
+  if (as->texMode) {
+      glUseProgram(program);
+      glUniform1i(glGetUniformLocation(program, "tex"), 0);
+  }
+  return program;
+}
 
-  /* red grows along x axis, green along y axis, b=1 constant */
+int
+main(int argc, char **argv)
+{
+  myAppState.appName = strdup(argv[0]);
 
-  for (j=0;j<*nVertsPerAxis+1;j++,y+=spacing, g+=dg, t+=dt)
-    {
-      x = 0.25 * screenWidth;
-      r = 0.0;
-      s = 0.0F;
+  myAppState.triangleAreaInPixels=DEFAULT_TRIANGLE_AREA;
+  myAppState.triangleType = DEFAULT_TRIANGLE_TYPE;
+  myAppState.testDurationSeconds=DEFAULT_TEST_DURATION_SECONDS;
+  myAppState.nFramesLimit=20;
+  myAppState.limitByFrames=0;
+  myAppState.imgWidth = DEFAULT_WIN_WIDTH;
+  myAppState.imgHeight = DEFAULT_WIN_HEIGHT;
+  myAppState.triangleLimit = DEFAULT_TRIANGLE_LIMIT;
+  myAppState.vertexBufLimit = DEFAULT_VERTEXBUF_LIMIT;
+  myAppState.outlineMode = DEFAULT_OUTLINE_MODE_BOOL;
+  myAppState.useFragShader = 0;
+  myAppState.fragWorkloadMode = 0;
+  myAppState.fragWorkload.loops = DEFAULT_FRAG_LOOPS;
+  myAppState.fragWorkload.ops = DEFAULT_FRAG_OPS;
+  myAppState.fragWorkload.chains = DEFAULT_FRAG_CHAINS;
+  myAppState.fragWorkload.trans = DEFAULT_FRAG_TRANS;
+  myAppState.fragWorkload.branch = BRANCH_NONE;
+  myAppState.divergeMatrix = 0;
+  myAppState.vertWorkloadMode = 0;
+  myAppState.vertWorkload.mats = 1;
+  myAppState.vertWorkload.bones = 0;
+  myAppState.vertWorkload.light = 0;
+  myAppState.vertCurve = 0;
+  myAppState.fetchAttribs = 0;
+  myAppState.fetchWidth = DEFAULT_FETCH_WIDTH;
+  myAppState.fetchSweep = 0;
+  myAppState.texMode = 0;
+  myAppState.texSize = DEFAULT_TEX_SIZE;
+  myAppState.texFormat = DEFAULT_TEX_FORMAT;
+  myAppState.texFilter = TEX_BILINEAR;
+  myAppState.texAniso = 1;
+  myAppState.texAccess = TEX_COHERENT;
+  myAppState.texScale = DEFAULT_TEX_SCALE;
+  myAppState.texAccessMatrix = 0;
+  myAppState.useVertShader = 0;
+  myAppState.headless = 0;
+  myAppState.coreProfile = 0;
+  myAppState.gpuTimers = DEFAULT_GPU_TIMERS_ENABLED;
+  myAppState.countFragments = 0;
+  myAppState.sweepMode = 0;
+  myAppState.earlyStop = 0;
+  myAppState.ciTolerance = DEFAULT_SWEEP_CI_TOLERANCE;
+  myAppState.indexBits = DEFAULT_INDEX_BITS;
+  myAppState.submitMode = SUBMIT_SINGLE_DRAW;
+  myAppState.positionFormat = POS_FLOAT;
+  myAppState.colorFormat = COLOR_FLOAT;
+  myAppState.interleaved = 0;
+  myAppState.formatMatrix = 0;
+  myAppState.uploadMode = UPLOAD_NONE;
+  myAppState.uploadMatrix = 0;
+  myAppState.uploadFramesInFlight = DEFAULT_UPLOAD_FRAMES_IN_FLIGHT;
+  myAppState.meshThreads = wesCpuCount();
+  myAppState.compileVariants = 0;
+  myAppState.compileThreads = wesCpuCount() < MAX_COMPILE_THREADS ?
+    wesCpuCount() : MAX_COMPILE_THREADS;
+  myAppState.uniformObjects = 0;
+  myAppState.window = NULL;
+  myAppState.meshStreams = 0;
+  myAppState.lockMeshPages = DEFAULT_LOCK_MESH_PAGES;
+  myAppState.meshCacheMB = DEFAULT_MESH_CACHE_MB;
+  myAppState.nTrials = DEFAULT_TRIALS;
+  myAppState.geomCacheDir = NULL;
+  myAppState.shaderCacheDir = NULL;
+  myAppState.streamMode = 0;
+  myAppState.streamTriangles = 0;
+  myAppState.streamChunkTriangles = DEFAULT_STREAM_CHUNK_TRIANGLES;
+  myAppState.retainedMode = DEFAULT_RETAINED_MODE_ENABLED;
+  myAppState.bufferUsage = DEFAULT_BUFFER_USAGE;
 
-      for (i=0;i<*nVertsPerAxis+1;i++, x+=spacing, r+=dr, s+=ds)
-        {
-          bv[indx].x = x;
-          bv[indx].y = y;
+  parseArgs(argc, argv, &myAppState);
 
-          bc[indx].r = r;
-          bc[indx].g = g;
-          bc[indx].b = 1.0F;
+  GLFWwindow* window = NULL;
+#if WESBENCH_HEADLESS
+  if (myAppState.headless != 0)
+    {
+      if (!initHeadlessContext(&myAppState))
+        exit(EXIT_FAILURE);
+      /* GLEW may complain about the missing GLX display; the GL
+         entry points it loads are fine regardless */
+      glewExperimental = myAppState.coreProfile ? GL_TRUE : GL_FALSE;
+      glewInit();
+      if (!initHeadlessFramebuffer(&myAppState))
+        exit(EXIT_FAILURE);
+    }
+  else
+#endif
+    {
+      glfwSetErrorCallback(error_callback);
 
-          bn[indx].x = x-(float)screenWidth*0.5;
-          bn[indx].y = y-(float)screenHeight*0.5;
-          bn[indx].z = (float)(screenWidth+screenHeight)*.25;
-          normalizeNormal(bn+indx);
+      if (!glfwInit())
+        exit(EXIT_FAILURE);
 
-          btc[indx].x = s;
-          btc[indx].y = t;
+      if (myAppState.coreProfile)
+        {
+          glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+          glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+          glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+          glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        }
+      else
+        {
+          glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+          glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+        }
 
-          indx++;
+      window = glfwCreateWindow(myAppState.imgWidth, myAppState.imgHeight, argv[0], NULL, NULL);
+      myAppState.window = window;
+      if (!window)
+        {
+          glfwTerminate();
+          exit(EXIT_FAILURE);
         }
-    }
-}
 
-void
-wesTriangleRateBenchmark(AppState *as)
-{
-  int startTime, endTime;
-  size_t totalTris=0, totalVerts=0;
-  float elapsedTimeSeconds, trisPerSecond, vertsPerSecond;
-  Vertex2D *baseVerts;
-  Color3D *baseColors;
-  Vertex3D *baseNormals;
-  Vertex2D *baseTCs;
-  GLuint trianglesListIndx = 0;
+      glfwSetKeyCallback(window, key_callback);
 
-  int nVertsPerAxis;
-  int nFrames=0;
+      glfwMakeContextCurrent(window);
+      // start GLEW extension handler
+      // core profiles need glewExperimental, GLEW only looks at the
+      // extension string otherwise
+      glewExperimental = myAppState.coreProfile ? GL_TRUE : GL_FALSE;
+      glewInit();
+      glfwSwapInterval(1);
+    }
+  /* GLEW's glGetString(GL_EXTENSIONS) is an error in a core profile */
+  if (myAppState.coreProfile)
+    glGetError();
 
-  Vertex2D *dispatchVerts=NULL;
-  Color3D *dispatchColors=NULL;
-  Vertex3D *dispatchNormals=NULL;
-  Vertex2D *dispatchTCs=NULL;
-  GLuint   *dispatchIndices=NULL;
-  int dispatchVertexCount, dispatchTriangles;
+  printInfo(window);
 
-  int screenWidth = as->imgWidth;
-  GLfloat r=screenWidth;
-  int screenHeight = as->imgHeight;
-  int testDurationSeconds = as->testDurationSeconds;
-  size_t triangleLimit = as->triangleLimit;
-  double triangleAreaPixels = as->triangleAreaInPixels;
+  shader_cache_init(myAppState.shaderCacheDir);
+  GLuint program = makeBenchmarkProgram(&myAppState);
 
+  Init();
+  if (myAppState.headless != 0)
+    {
+      /* nothing to swap or poll, runBenchmark() exits when done */
+      glUseProgram(program);
+      runBenchmark();
+    }
+  while (!glfwWindowShouldClose(window))
+    {
+      glUseProgram(program);
+      runBenchmark();
+      glfwSwapBuffers(window);
+      glfwPollEvents();
+    }
+  return 0;
+}
 
-  /*
-   * Objective(s):
-   * 1. Want triangles with a specified area (e.g., 8sq pixels) for the
-   * purpose of generating a graphics load with reasonably precise
-   * characteristics .
-   * 2. Want triangles to *all* remain on-screen so that triangle rate
-   * reflects the cost of rendering visible triangles/fragments.
-   *
-   * Approach:
-   * 1. build a base mesh of vertices. This set of verts is positioned
-   * so that it will remain entirely within the view frustum no matter
-   * how we rotate it (in 2D)
-   * 2. dispatch off the mesh vertices as disjoint triangles using
-   * vertex arrays. This approach is not the most efficient way to
-   * represent densely packed triangles, but has a couple of benefits:
-   * - It allows us to easily set the maximum number of triangles per
-   *   frame to be dispatched off to the renderer w/o having to resort
-   *   to tricks like inserting degenerate triangles in strips to connect
-   *   up two disjoint strips.
-   * - It allows us to glDrawArrays rather than glDrawElements. The latter
-   *   uses one level of indirection, and will be less efficient.
-   * - In the end, we care about vertex rate, not triangle rate.
-   *
-   * An early version of this code used the glDrawElements with indices.
-   * Rather than insert compile-time switches, this old code is simply
-   * cut-n-pasted and commented out at the end of this file.
-   */
+void printInfo (GLFWwindow * window) {
 
-  /* Make sure we are drawing to the front buffer */
-  glDrawBuffer(GL_FRONT);
-  glDisable(GL_DEPTH_TEST);
+  /* Display the gfx card information */
+  printf( "--------------------------------------------------\n");
+  printf ("Vendor:      %s\n", glGetString(GL_VENDOR));
+  printf ("Renderer:    %s\n", glGetString(GL_RENDERER));
+  printf ("Version:     %s\n", glGetString(GL_VERSION));
+  if (window == NULL)
+    {
+      printf( "Visual:      offscreen FBO, RGBA8\n");
+      printf( "Geometry:    %dx%d (headless)\n",
+              myAppState.imgWidth,
+              myAppState.imgHeight);
+    }
+  else
+    {
+      GLFWmonitor * monitor = glfwGetPrimaryMonitor();
+      const GLFWvidmode * vidMode = glfwGetVideoMode(monitor);
+      printf( "Visual:      RGBA=<%d,%d,%d,%d>  Z=<%d>  double=%d\n",
+              vidMode->redBits,
+              vidMode->blueBits,
+              vidMode->greenBits,
+              GLFW_ALPHA_BITS,
+              GLFW_DEPTH_BITS,
+              1 );
+      int winWidth, winHeight;
+      glfwGetFramebufferSize(window, &winWidth, &winHeight);
+      int xPos, yPos;
+      glfwGetWindowPos(window, &xPos, &yPos);
+      printf( "Geometry:    %dx%d+%d+%d\n",
+              winWidth,
+              winHeight,
+              xPos,
+              yPos);
+      printf( "Screen:      %dx%d\n",
+              vidMode->width,
+              vidMode->height);
+    }
+  printf( "--------------------------------------------------\n");
 
-  /* Clear the screen */
-  glClear(GL_COLOR_BUFFER_BIT);
 
-  if (as->outlineMode != 0)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  else
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  /* print out the test parameters */
 
-  /* Load identities */
-  glMatrixMode( GL_PROJECTION );
-  glPushMatrix();
-  glLoadIdentity( );
+  printf("Triangle area\t%4.3f (pixels^2)\n", myAppState.triangleAreaInPixels);
+  printf("Test duration\t%f(s)\n", myAppState.testDurationSeconds);
+  printf("Screen W/H\t(%d,%d)\n", myAppState.imgWidth, myAppState.imgHeight);
+  printf("Triangle limit\t%ld\n", myAppState.triangleLimit);
+  printf("VertexBuf limit\t%ld\n", myAppState.vertexBufLimit);
+  printf("Triangle type\t%d (%s)\n", myAppState.triangleType,
+         triangleTypeNames[myAppState.triangleType]);
+  printf("Submission\t%d (%s)\n", myAppState.submitMode,
+         submitModeNames[myAppState.submitMode]);
+  printf("Retained mode\t%d (usage 0x%04x)\n", myAppState.retainedMode, myAppState.bufferUsage);
+  printf("Backend\t%s\n", myAppState.coreProfile ?
+         "core profile (VAO, generic attributes, Transform uniform block)" :
+         "compatibility (fixed-function arrays, matrix stack)");
+  if (myAppState.texMode)
+    printf("Texture\t%dx%d %s, %s filter, %dx aniso, %s access\n",
+           myAppState.texSize, myAppState.texSize, texFormats[myAppState.texFormat].name,
+           texFilterNames[myAppState.texFilter], myAppState.texAniso,
+           texAccessNames[myAppState.texAccess]);
 
-  glMatrixMode( GL_MODELVIEW );
-  glPushMatrix();
-  glLoadIdentity();
+}
 
-  /* change range from -1..1 to 0..[screenWidth, screenHeight] */
-  glTranslatef(-1.0, -1.0, 0.0);
-  glScalef(2.0/r, 2.0/r, 1.0F);
+/* the one-line summary that follows each benchmark run */
+static void
+reportResults(AppState *as)
+{
+  fprintf(stderr," WesBench: area=%2.1f px, tri rate = %3.2f Mtri/sec, vertex rate=%3.2f Mverts/sec, fill rate = %4.2f Mpix/sec, verts/bucket=%zu, indices/bucket=%zu\n", as->triangleAreaInPixels, as->computedMTrisPerSecond, as->computedMVertexOpsPerSecond, as->computedMFragsPerSecond, as->computedVertsPerArrayCall, as->computedIndicesPerArrayCall);
+  if (as->countFragments)
+    fprintf(stderr," WesBench: measured fill rate = %4.2f Mpix/sec (estimate %4.2f), %.0f frags/frame\n", as->computedMeasuredMFragsPerSecond, as->computedMFragsPerSecond, as->computedFragsPerFrame);
+  if (as->submitMode != SUBMIT_SINGLE_DRAW)
+    fprintf(stderr," WesBench: %s, %d draws/frame, %.0f draws/sec, %.1f CPU ns/draw\n", submitModeNames[as->submitMode], as->computedDrawsPerFrame, as->computedDrawsPerSecond, as->computedCpuNsPerDraw);
+  fprintf(stderr," WesBench: %s frame time p50/p90/p99/max = %.3f/%.3f/%.3f/%.3f ms\n", as->computedFrameMsFromGPU ? "GPU" : "CPU", as->computedFrameMs[0], as->computedFrameMs[1], as->computedFrameMs[2], as->computedFrameMs[3]);
+  fprintf(stderr," WesBench: mesh memory peak = %.1f MB\n", as->computedMeshPeakMB);
+  if (as->uploadMode != UPLOAD_NONE)
+    fprintf(stderr," WesBench: upload %s, %.2f GB/s, %.3f ms/frame stalled\n", uploadModeNames[as->uploadMode], as->computedUploadGBPerSecond, as->computedUploadStallMsPerFrame);
+  if (as->fetchAttribs > 0)
+    fprintf(stderr," WesBench: %d attributes, %zu bytes/vert: %.3f Mverts/sec, %.3f GB/s fetched\n", as->fetchAttribs, as->computedBytesPerVertex, as->computedMVertexOpsPerSecond, as->computedFetchGBPerSecond);
+  if (as->texMode)
+    fprintf(stderr," WesBench: texture %s %s, %s access: %.3f Gtexels/sec, %.2f MB/frame touched, %.1fx texel reuse\n", texFormats[as->texFormat].name, texFilterNames[as->texFilter], texAccessNames[as->texAccess], as->computedGTexelsPerSecond, as->computedTexWorkingSetMB, as->computedTexReuse);
+  if (as->vertWorkloadMode)
+    fprintf(stderr," WesBench: vertex ALU %d mats, %d bones, lighting %s: %.3f Mverts/sec at ~%.0f flops/vert, %.3f GFLOP/s\n", as->vertWorkload.mats, as->vertWorkload.bones, as->vertWorkload.light ? "on" : "off", as->computedMVertexOpsPerSecond, vertWorkloadFlops(&as->vertWorkload), as->computedVertGFlopsPerSecond);
+  if (as->fragWorkloadMode)
+    fprintf(stderr," WesBench: fragment ALU %.3f GFLOP/s, %.3f ns/frag (%s branch, %s fragment count)\n", as->computedFragGFlopsPerSecond, as->computedNsPerFragment, branchModeNames[as->fragWorkload.branch], as->countFragments ? "measured" : "estimated");
+  if (as->streamMode)
+    fprintf(stderr," WesBench: streaming %.2f GB/s of geometry, %.1f%% of the run waiting on the ring\n", as->computedStreamGBPerSecond, as->computedStreamStallPercent);
+}
 
+/*
+ * Adaptive triangle area sweep. Small triangles are vertex-bound with a
+ * flat triangle rate Tv, big ones fill-bound with a flat pixel rate F, and
+ * the throughput in between is well modelled by 1/T = 1/Tv + area/F. The
+ * crossover area F/Tv is found by bisecting log2(area): a point is taken
+ * as vertex-bound when its triangle rate is relatively closer to the
+ * smallest-area point's than its pixel rate is to the largest-area
+ * point's. The model is then fit to every measured point.
+ */
+static double
+measureSweepPoint(AppState *as, double log2Area, double *pts, int *nPts)
+{
+  as->triangleAreaInPixels = pow(2.0, log2Area);
+  wesTriangleRateBenchmark(as);
+  reportResults(as);
+  if (*nPts < SWEEP_MAX_POINTS)
+    {
+      pts[2*(*nPts)] = as->triangleAreaInPixels;
+      pts[2*(*nPts)+1] = as->computedMTrisPerSecond;
+      (*nPts)++;
+    }
+  return as->computedMTrisPerSecond;
+}
 
-  glDisable(GL_LIGHTING);
+void
+runAreaSweep(AppState *as)
+{
+  double pts[2*SWEEP_MAX_POINTS];
+  int nPts = 0, k;
+  double lo = SWEEP_MIN_LOG2_AREA, hi = SWEEP_MAX_LOG2_AREA;
+  double tLo, tHi, pHi;
+  double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, det, invTv, invF;
+  double crossover;
+  double sweepStart = wesGetTime();
 
-  glDisable(GL_TEXTURE_2D);
+  as->earlyStop = 1;
 
-  /* build the base quadmesh vertex array */
-  buildBaseArrays(triangleAreaPixels, as->imgWidth, as->imgHeight,
-                  &nVertsPerAxis,
-                  &baseVerts, &baseColors, &baseNormals, &baseTCs);
+  tLo = measureSweepPoint(as, lo, pts, &nPts);
+  tHi = measureSweepPoint(as, hi, pts, &nPts);
+  pHi = tHi*pow(2.0, hi);
 
-  /* now, repackage that information into bundles suitable for submission
-     to GL using the specified primitive type*/
-  if (as->triangleType == DISJOINT_TRIANGLES)
+  while (hi - lo > SWEEP_LOG2_RESOLUTION && tLo > 0.0 && pHi > 0.0)
     {
-      int triangleLimit;
+      double mid = 0.5*(lo + hi);
+      double t = measureSweepPoint(as, mid, pts, &nPts);
 
-      if ((as->triangleLimit*3) > as->vertexBufLimit)
-        triangleLimit = as->vertexBufLimit/3;
+      if (t/tLo > t*pow(2.0, mid)/pHi)
+        lo = mid;               /* still vertex-bound */
       else
-        triangleLimit = as->triangleLimit;
-
-      buildDisjointTriangleArrays(nVertsPerAxis,
-                                  triangleLimit,
-                                  &dispatchTriangles,
-                                  &dispatchVertexCount,
-                                  baseVerts, baseColors,
-                                  baseNormals, baseTCs,
-                                  &dispatchVerts,
-                                  &dispatchColors,
-                                  &dispatchNormals,
-                                  &dispatchTCs);
-      as->computedVertsPerArrayCall = dispatchVertexCount;
-      as->computedIndicesPerArrayCall = 0;
+        hi = mid;
     }
+  crossover = pow(2.0, 0.5*(lo + hi));
 
-  /* Set up the pointers */
-  glVertexPointer(2, GL_FLOAT, 0, (const GLvoid *)dispatchVerts);
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glColorPointer(3, GL_FLOAT, 0, (const GLvoid *)dispatchColors);
-  glEnableClientState(GL_COLOR_ARRAY);
-
-
-  glFinish();                 /* make sure all setup is finished */
-
-  startTime = endTime = glfwGetTime();
+  /* weighted least squares on 1/T = 1/Tv + a/F, weights T^2 so that
+     every point counts by its relative error */
+  for (k=0;k<nPts;k++)
+    {
+      double a = pts[2*k], t = pts[2*k+1], w = t*t;
+      if (t <= 0.0)
+        continue;
+      sw += w; sx += w*a; sy += w/t; sxx += w*a*a; sxy += w*a/t;
+    }
+  det = sw*sxx - sx*sx;
+  invTv = (det != 0.0) ? (sxx*sy - sx*sxy)/det : 0.0;
+  invF = (det != 0.0) ? (sw*sxy - sx*sy)/det : 0.0;
+
+  printf("--------------------------------------------------\n");
+  printf("Area sweep:\t%d points in %.2f(s)\n", nPts, wesGetTime() - sweepStart);
+  printf("Bisected crossover area\t%.1f (pixels^2)\n", crossover);
+  if (invTv > 0.0 && invF > 0.0)
+    {
+      double l2;
 
-   if (SCREENSHOT_MODE == 1) {
-        /* screenshot mode won't work with -retained */
-        /* Clear the screen */
-        glClear(GL_COLOR_BUFFER_BIT);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArrays(GL_TRIANGLES, 0, dispatchVertexCount);
-        glDrawArrays(GL_TRIANGLES, 0, dispatchVertexCount);
-        fprintf(stderr," You have screenshot mode enabled! \n");
-        fflush(stderr);
-        sleep(5);
-   } else if (myAppState.limitByFrames == 1) {
-      while (nFrames < myAppState.nFramesLimit)
+      printf("Fitted model\t1/T = 1/%.3f Mtri/sec + area/%.2f Mpix/sec\n",
+             1.0/invTv, 1.0/invF);
+      printf("Fitted crossover area\t%.1f (pixels^2)\n", invTv/invF);
+      printf("   area(px)  fit Mtri/sec  fit Mpix/sec\n");
+      for (l2=SWEEP_MIN_LOG2_AREA;l2<=SWEEP_MAX_LOG2_AREA;l2+=1.0)
         {
-
-          glDrawArrays(GL_TRIANGLES, 0, dispatchVertexCount);
-
-          glTranslatef(r/2.0, r/2.0, 0.0F);
-          glRotatef(0.01F, 0.0F, 0.0F, 1.0F);
-          glTranslatef(-r/2.0, -r/2.0, 0.0F);
-
-          endTime = glfwGetTime();
-
-          nFrames++;
-          totalTris += dispatchTriangles;
-          totalVerts += as->computedVertsPerArrayCall;
+          double a = pow(2.0, l2), t = 1.0/(invTv + a*invF);
+          printf("  %9.0f  %12.3f  %12.2f\n", a, t, t*a);
         }
-        
-   } else {
-      while ((endTime - startTime) < testDurationSeconds)
-        {
-          glDrawArrays(GL_TRIANGLES, 0, dispatchVertexCount);
-
-          glTranslatef(r/2.0, r/2.0, 0.0F);
-          glRotatef(0.01F, 0.0F, 0.0F, 1.0F);
-          glTranslatef(-r/2.0, -r/2.0, 0.0F);
+      fprintf(stderr," WesBench: sweep crossover area = %.1f px (fit %.1f px), vertex-bound %.3f Mtri/sec, fill-bound %.2f Mpix/sec\n",
+              crossover, invTv/invF, 1.0/invTv, 1.0/invF);
+    }
+  else
+    {
+      printf("Fitted model\tdegenerate (one regime only?), measured points:\n");
+      for (k=0;k<nPts;k++)
+        printf("  %9.0f  %12.3f\n", pts[2*k], pts[2*k+1]);
+      fprintf(stderr," WesBench: sweep crossover area = %.1f px\n", crossover);
+    }
+}
 
-          endTime = glfwGetTime();
+/*
+ * Run every vertex format and layout once (with early stopping) and
+ * tabulate what each costs to fetch.
+ */
+void
+runFormatMatrix(AppState *as)
+{
+  int pf, cf, il, n = 0, k;
+  struct
+  {
+    int pf, cf, il, supported;
+    size_t bytes;
+    double mverts, mtris;
+  } rows[3*5*2];
+
+  as->earlyStop = 1;
+  for (pf=POS_FLOAT;pf<=POS_SHORT;pf++)
+    for (cf=COLOR_FLOAT;cf<=COLOR_INT_2_10_10_10;cf++)
+      for (il=0;il<2;il++, n++)
+        {
+          rows[n].pf = pf;
+          rows[n].cf = cf;
+          rows[n].il = il;
+          rows[n].supported = vertexFormatSupported((PositionFormat)pf, (ColorFormat)cf);
+          if (!rows[n].supported)
+            continue;
+          as->positionFormat = (PositionFormat)pf;
+          as->colorFormat = (ColorFormat)cf;
+          as->interleaved = il;
+          wesTriangleRateBenchmark(as);
+          reportResults(as);
+          rows[n].bytes = as->computedBytesPerVertex;
+          rows[n].mverts = as->computedMVertexOpsPerSecond;
+          rows[n].mtris = as->computedMTrisPerSecond;
+        }
 
-          nFrames++;
-          totalTris += dispatchTriangles;
-          totalVerts += as->computedVertsPerArrayCall;
+  printf("--------------------------------------------------\n");
+  printf("  position       color       layout  bytes/vert   Mverts/sec   Mtri/sec  fetch GB/sec\n");
+  for (k=0;k<n;k++)
+    {
+      if (!rows[k].supported)
+        {
+          printf("  %8s  %10s  %11s  unsupported\n", positionFormats[rows[k].pf].name,
+                 colorFormats[rows[k].cf].name, rows[k].il ? "interleaved" : "separate");
+          continue;
         }
+      printf("  %8s  %10s  %11s  %10zu  %11.3f  %9.3f  %12.3f\n",
+             positionFormats[rows[k].pf].name, colorFormats[rows[k].cf].name,
+             rows[k].il ? "interleaved" : "separate", rows[k].bytes,
+             rows[k].mverts, rows[k].mtris, rows[k].mverts*rows[k].bytes/1000.0);
+    }
+}
 
-  }
+/*
+ * -attribsweep: -attribs 1 through MAX_FETCH_ATTRIBS, each with its
+ * own program, then vertex rate against bytes fetched per vertex. The
+ * knee is where fetch bandwidth, not the vertex count, sets the rate.
+ */
+static void
+runFetchSweep(AppState *as)
+{
+  int n, k;
+  GLint savedProgram;
+  struct
+  {
+    size_t bytes;
+    double mverts, gbps;
+  } rows[MAX_FETCH_ATTRIBS+1];
 
+  glGetIntegerv(GL_CURRENT_PROGRAM, &savedProgram);
+  as->earlyStop = 1;
+  for (n=1;n<=MAX_FETCH_ATTRIBS;n++)
+    {
+      GLuint program;
 
-  glFinish();
-  endTime = glfwGetTime();
+      as->fetchAttribs = n;
+      program = makeBenchmarkProgram(as);
+      glUseProgram(program);
+      wesTriangleRateBenchmark(as);
+      reportResults(as);
+      rows[n].bytes = as->computedBytesPerVertex;
+      rows[n].mverts = as->computedMVertexOpsPerSecond;
+      rows[n].gbps = as->computedFetchGBPerSecond;
+      glUseProgram(savedProgram);
+      glDeleteProgram(program);
+    }
 
-  /* Restore the gl stack */
-  glMatrixMode( GL_MODELVIEW );
-  glPopMatrix();
+  printf("--------------------------------------------------\n");
+  printf("Attribute sweep:\t%d floats per extra attribute\n", as->fetchWidth);
+  printf("  attribs  bytes/vert   Mverts/sec  fetch GB/sec\n");
+  for (k=1;k<=MAX_FETCH_ATTRIBS;k++)
+    printf("  %7d  %10zu  %11.3f  %12.3f\n", k, rows[k].bytes, rows[k].mverts, rows[k].gbps);
+}
 
-  glMatrixMode( GL_PROJECTION );
-  glPopMatrix();
+/*
+ * -vertcurve: the -vert workload with 0, 1, 2, 4 ... MAX_VERT_MATS
+ * chained transforms (bones and lighting as given), each with its own
+ * program, then vertex rate against the work per vertex.
+ */
+static void
+runVertexCurve(AppState *as)
+{
+  int mats, k, n = 0;
+  GLint savedProgram;
+  struct
+  {
+    int mats;
+    double flops, mverts, gflops;
+  } rows[16];
 
-  /* Before printing the results, make sure we didn't have
-  ** any GL related errors. */
-  check_gl_errors();
+  glGetIntegerv(GL_CURRENT_PROGRAM, &savedProgram);
+  as->earlyStop = 1;
+  for (mats=0;mats<=MAX_VERT_MATS;mats=mats ? 2*mats : 1, n++)
+    {
+      GLuint program;
 
-  /* the pause that refreshes -- */
-#ifdef _WIN32
-  Sleep(250);
-#else
-  usleep(250000);
-#endif
+      as->vertWorkload.mats = mats;
+      program = makeBenchmarkProgram(as);
+      glUseProgram(program);
+      wesTriangleRateBenchmark(as);
+      reportResults(as);
+      rows[n].mats = mats;
+      rows[n].flops = vertWorkloadFlops(&as->vertWorkload);
+      rows[n].mverts = as->computedMVertexOpsPerSecond;
+      rows[n].gflops = as->computedVertGFlopsPerSecond;
+      glUseProgram(savedProgram);
+      glDeleteProgram(program);
+    }
 
-  /* TODO: compute/return the mFrags/sec */
+  printf("--------------------------------------------------\n");
+  printf("Vertex curve:\t%d bones, lighting %s\n", as->vertWorkload.bones,
+         as->vertWorkload.light ? "on" : "off");
+  printf("   mats  flops/vert   Mverts/sec   GFLOP/s\n");
+  for (k=0;k<n;k++)
+    printf("  %5d  %10.0f  %11.3f  %8.3f\n", rows[k].mats, rows[k].flops,
+           rows[k].mverts, rows[k].gflops);
+}
 
-  elapsedTimeSeconds = endTime - startTime;
-  as->computedMTrisPerSecond = ((totalTris)/1000000.0f)/elapsedTimeSeconds;
-  as->computedMVertexOpsPerSecond = ((totalVerts) / 1000000.0f) / elapsedTimeSeconds;
-  as->computedFPS = (nFrames + 1.0f) / elapsedTimeSeconds;
-  as->computedMFragsPerSecond = as->computedMTrisPerSecond*as->triangleAreaInPixels;
+/*
+ * -diverge all: the same three-way split of the -frag workload under
+ * every branch mode, each with its own program, then the slowdown of
+ * each against the uniform branch.
+ */
+static void
+runDivergenceMatrix(AppState *as)
+{
+  int m, k;
+  GLint savedProgram;
+  double nsPerFrag[BRANCH_MIX+1], fragsPerFrame[BRANCH_MIX+1];
 
-  printf("verts/frame = %d \n", dispatchVertexCount);
-  printf("nframes = %d \n", nFrames);
-  printf("Elapsed time:\t%f(s)\n ", elapsedTimeSeconds);
-  printf("Dispatched Triangles Per Frame: %d \n", dispatchTriangles);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &savedProgram);
+  as->earlyStop = 1;
+  for (m=BRANCH_UNIFORM;m<=BRANCH_MIX;m++)
+    {
+      GLuint program;
 
-  free((void *)baseVerts);
-  free((void *)baseColors);
-  free((void *)baseNormals);
-  free((void *)baseTCs);
-  free((void *)dispatchVerts);
-  free((void *)dispatchColors);
-  free((void *)dispatchNormals);
-  free((void *)dispatchTCs);
+      as->fragWorkload.branch = (BranchMode)m;
+      program = makeBenchmarkProgram(as);
+      glUseProgram(program);
+      wesTriangleRateBenchmark(as);
+      reportResults(as);
+      nsPerFrag[m] = as->computedNsPerFragment;
+      fragsPerFrame[m] = as->computedFragsPerFrame;
+      glUseProgram(savedProgram);
+      glDeleteProgram(program);
+    }
 
-  if (dispatchIndices != NULL)
-    free((void *)dispatchIndices);
+  printf("--------------------------------------------------\n");
+  printf("  %-16s  %9s  %12s  slowdown vs uniform\n", "branch", "ns/frag", "frags/frame");
+  for (k=BRANCH_UNIFORM;k<=BRANCH_MIX;k++)
+    printf("  %-16s  %9.3f  %12.0f  %18.2fx\n", branchModeNames[k], nsPerFrag[k],
+           fragsPerFrame[k],
+           nsPerFrag[BRANCH_UNIFORM] > 0.0 ? nsPerFrag[k]/nsPerFrag[BRANCH_UNIFORM] : 0.0);
+  for (k=BRANCH_TILE;k<=BRANCH_MIX;k++)
+    fprintf(stderr," WesBench: %s branch %.2fx the uniform branch's time per fragment\n",
+            branchModeNames[k],
+            nsPerFrag[BRANCH_UNIFORM] > 0.0 ? nsPerFrag[k]/nsPerFrag[BRANCH_UNIFORM] : 0.0);
 }
 
+/*
+ * -texaccess all: the same texture and filter under each access pattern,
+ * then the slowdown of each against coherent access. Random access
+ * touches about as many texels as coherent, so its slowdown is what
+ * losing the texture cache's locality costs.
+ */
+static void
+runTextureAccessMatrix(AppState *as)
+{
+  int a, k;
+  struct
+  {
+    double gtexels, mb, reuse;
+  } rows[TEX_RANDOM+1];
 
-/* A simple routine which checks for GL errors. */
-void check_gl_errors (void) {
-  GLenum err;
-  err = glGetError();
-  if (err != GL_NO_ERROR) {
-    fprintf (stderr, "GL Error: ");
-    switch (err) {
-    case GL_INVALID_ENUM:
-      fprintf (stderr, "Invalid Enum\n");
-      break;
-    case GL_INVALID_VALUE:
-      fprintf (stderr, "Invalid Value\n");
-      break;
-    case GL_INVALID_OPERATION:
-      fprintf (stderr, "Invalid Operation\n");
-      break;
-    case GL_STACK_OVERFLOW:
-      fprintf (stderr, "Stack Overflow\n");
-      break;
-    case GL_STACK_UNDERFLOW:
-      fprintf (stderr, "Stack Underflow\n");
-      break;
-    case GL_OUT_OF_MEMORY:
-      fprintf (stderr, "Out of Memory\n");
-      break;
-    default:
-      fprintf (stderr, "Unknown\n");
+  as->earlyStop = 1;
+  for (a=TEX_COHERENT;a<=TEX_RANDOM;a++)
+    {
+      as->texAccess = (TexAccess)a;
+      wesTriangleRateBenchmark(as);
+      reportResults(as);
+      rows[a].gtexels = as->computedGTexelsPerSecond;
+      rows[a].mb = as->computedTexWorkingSetMB;
+      rows[a].reuse = as->computedTexReuse;
     }
-    exit(1);
-  }
+
+  printf("--------------------------------------------------\n");
+  printf("Texture access:\t%dx%d %s, %s, texscale %.2f\n", as->texSize, as->texSize,
+         texFormats[as->texFormat].name, texFilterNames[as->texFilter], as->texScale);
+  printf("  %-10s  Gtexels/sec  MB/frame  reuse  slowdown vs coherent\n", "access");
+  for (k=TEX_COHERENT;k<=TEX_RANDOM;k++)
+    printf("  %-10s  %11.3f  %8.2f  %5.1f  %19.2fx\n", texAccessNames[k],
+           rows[k].gtexels, rows[k].mb, rows[k].reuse,
+           rows[k].gtexels > 0.0 ? rows[TEX_COHERENT].gtexels/rows[k].gtexels : 0.0);
 }
 
-void Init (void) {
-  /* Init does nothing */
+/*
+ * -compilebench N: N variants of hello-gl.v.glsl + hello-gl.f.glsl, each
+ * with its own OPTION_n #defines (the bits of its index) after the
+ * #version line, compiled and linked three ways: one after another,
+ * all issued at once for the driver's KHR_parallel_shader_compile
+ * threads to pick up, and split over -compilethreads worker threads
+ * each with its own shared context. Every pass gets a fresh
+ * VARIANT_SEED, so a driver's own shader cache can't serve one pass
+ * from the one before.
+ */
+typedef struct
+{
+  GLchar **vs, **fs;
+  GLuint *programs;
+  SharedContext context;
+  double start;               /* the pass's clock origin */
+  double firstReady, lastReady; /* seconds after start */
+  int failed;
+} CompileJob;
+
+static GLchar *
+makeShaderVariant(const GLchar *source, int variant, unsigned int seed)
+{
+  const GLchar *body = source;
+  size_t size = strlen(source) + 64*(COMPILE_VARIANT_OPTIONS + 4), n = 0;
+  GLchar *src = (GLchar *)malloc(size);
+  int b;
+
+  if (src == NULL)
+    {
+      fprintf(stderr, "Error: out of memory generating shader variants\n");
+      exit(1);
+    }
+  if (strncmp(source, "#version", 8) == 0)
+    {
+      body = strchr(source, '\n');
+      body = body != NULL ? body + 1 : source + strlen(source);
+      shaderAppend(src, size, &n, "%.*s", (int)(body - source), source);
+    }
+  shaderAppend(src, size, &n, "#define VARIANT_ID %d\n#define VARIANT_SEED %u\n", variant, seed);
+  for (b=0;b<COMPILE_VARIANT_OPTIONS;b++)
+    if (variant & (1 << b))
+      shaderAppend(src, size, &n, "#define OPTION_%d 1\n", b);
+  /* keep the compiler's line numbers matching the file */
+  shaderAppend(src, size, &n, "#line %d\n%s", body != source ? 2 : 1, body);
+  return src;
 }
 
-void Reshape (int x, int y) {
-  /* Reshape does nothing */
-  (void) x;
-  (void) y;
+/* compile and link without asking how it went, so nothing waits here */
+static GLuint
+issueCompile(const GLchar *vs, const GLchar *fs)
+{
+  GLuint program = glCreateProgram();
+  GLuint shaders[2];
+  int k;
+
+  shaders[0] = glCreateShader(GL_VERTEX_SHADER);
+  shaders[1] = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(shaders[0], 1, &vs, NULL);
+  glShaderSource(shaders[1], 1, &fs, NULL);
+  for (k=0;k<2;k++)
+    {
+      glCompileShader(shaders[k]);
+      glAttachShader(program, shaders[k]);
+    }
+  glBindAttribLocation(program, 0, "position");
+  glLinkProgram(program);
+  for (k=0;k<2;k++)
+    glDeleteShader(shaders[k]);
+  return program;
 }
 
+static int
+programLinked(GLuint program)
+{
+  GLint ok;
 
-void Key(unsigned char a, int x, int y) {
-  /* Key does nothing */
-  (void) x;
-  (void) y;
-  (void) a;
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  return ok;
 }
 
-static void error_callback(int error, const char* description)
+/* one worker's share of the variants, on its own shared context */
+static void
+compileRange(void *ctx, int begin, int end)
 {
-  fprintf(stderr, "Error: %s\n", description);
+  CompileJob *job = (CompileJob *)ctx;
+  int k;
+
+  bindSharedContext(&job->context, 1);
+  for (k=begin;k<end;k++)
+    {
+      job->programs[k] = issueCompile(job->vs[k], job->fs[k]);
+      if (!programLinked(job->programs[k]))
+        job->failed++;
+      if (k == begin)
+        job->firstReady = wesGetTime() - job->start;
+    }
+  /* the other contexts see the programs once this one is done with them */
+  glFinish();
+  job->lastReady = wesGetTime() - job->start;
+  bindSharedContext(&job->context, 0);
 }
 
-static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+static void
+runCompileBenchmark(AppState *as)
 {
-  if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-    glfwSetWindowShouldClose(window, GLFW_TRUE);
-}
+  static const char *pathNames[] =
+    { "serial", "KHR_parallel_shader_compile", "shared contexts" };
+  int n = as->compileVariants, nThreads = as->compileThreads;
+  GLchar *vsFile, *fsFile;
+  GLint length;
+  GLuint *programs = (GLuint *)calloc(n, sizeof(GLuint));
+  GLchar **vs = (GLchar **)calloc(n, sizeof(GLchar *));
+  GLchar **fs = (GLchar **)calloc(n, sizeof(GLchar *));
+  int *ready = (int *)calloc(n, sizeof(int));
+  unsigned int seed = (unsigned int)(wesGetTime()*1.0e6);
+  int path, k, t;
+  struct
+  {
+    int supported, failed;
+    double firstReady, lastReady;
+  } rows[3];
 
+  vsFile = file_contents("hello-gl.v.glsl", &length);
+  fsFile = file_contents("hello-gl.f.glsl", &length);
+  if (vsFile == NULL || fsFile == NULL)
+    exit(EXIT_FAILURE);
+  if (programs == NULL || vs == NULL || fs == NULL || ready == NULL)
+    {
+      fprintf(stderr, "Error: out of memory for %d shader variants\n", n);
+      exit(1);
+    }
 
-static GLuint make_shader(GLenum type, const char *filename)
-{
-    GLint length;
-    GLchar *source = file_contents(filename, &length);
-    GLuint shader;
-    GLint shader_ok;
+  for (path=0;path<3;path++)
+    {
+      double start;
+
+      memset(&rows[path], 0, sizeof(rows[path]));
+      for (k=0;k<n;k++)
+        {
+          vs[k] = makeShaderVariant(vsFile, k, seed + path);
+          fs[k] = makeShaderVariant(fsFile, k, seed + path);
+        }
 
-    if (!source)
-        return 0;
+      if (path == 0)
+        {
+          rows[path].supported = 1;
+          start = wesGetTime();
+          for (k=0;k<n;k++)
+            {
+              programs[k] = issueCompile(vs[k], fs[k]);
+              if (!programLinked(programs[k]))
+                rows[path].failed++;
+              if (k == 0)
+                rows[path].firstReady = wesGetTime() - start;
+            }
+          rows[path].lastReady = wesGetTime() - start;
+        }
+      else if (path == 1)
+        {
+          int remaining = n;
+
+          rows[path].supported =
+            GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+          if (rows[path].supported)
+            {
+              if (GLEW_KHR_parallel_shader_compile)
+                glMaxShaderCompilerThreadsKHR(nThreads);
+              else
+                glMaxShaderCompilerThreadsARB(nThreads);
+              memset(ready, 0, n*sizeof(int));
+              start = wesGetTime();
+              for (k=0;k<n;k++)
+                programs[k] = issueCompile(vs[k], fs[k]);
+              /* COMPLETION_STATUS is the one query that never waits */
+              while (remaining > 0)
+                {
+                  for (k=0;k<n;k++)
+                    {
+                      GLint done;
+
+                      if (ready[k])
+                        continue;
+                      glGetProgramiv(programs[k], GL_COMPLETION_STATUS_KHR, &done);
+                      if (!done)
+                        continue;
+                      ready[k] = 1;
+                      if (remaining-- == n)
+                        rows[path].firstReady = wesGetTime() - start;
+                    }
+                  if (remaining > 0)
+#ifdef _WIN32
+                    Sleep(0);
+#else
+                    usleep(100);
+#endif
+                }
+              rows[path].lastReady = wesGetTime() - start;
+              for (k=0;k<n;k++)
+                if (!programLinked(programs[k]))
+                  rows[path].failed++;
+            }
+        }
+      else
+        {
+          CompileJob jobs[MAX_COMPILE_THREADS];
+          RangeJob ranges[MAX_COMPILE_THREADS];
+#ifdef _WIN32
+          HANDLE threads[MAX_COMPILE_THREADS];
+#else
+          pthread_t threads[MAX_COMPILE_THREADS];
+#endif
+          int nJobs = nThreads < n ? nThreads : n, per = (n + nJobs - 1)/nJobs;
+
+          rows[path].supported = 1;
+          for (t=0;t<nJobs;t++)
+            {
+              memset(&jobs[t], 0, sizeof(jobs[t]));
+              jobs[t].vs = vs;
+              jobs[t].fs = fs;
+              jobs[t].programs = programs;
+              if (!createSharedContext(&jobs[t].context, as))
+                {
+                  fprintf(stderr, "Error: unable to create shared context %d\n", t);
+                  rows[path].supported = 0;
+                  nJobs = t;
+                  break;
+                }
+              ranges[t].fn = compileRange;
+              ranges[t].ctx = &jobs[t];
+              ranges[t].begin = t*per < n ? t*per : n;
+              ranges[t].end = (t+1)*per < n ? (t+1)*per : n;
+            }
+          if (rows[path].supported)
+            {
+              /* contexts are set up before the clock starts */
+              start = wesGetTime();
+              for (t=0;t<nJobs;t++)
+                {
+                  jobs[t].start = start;
+#ifdef _WIN32
+                  threads[t] = CreateThread(NULL, 0, rangeJobThread, &ranges[t], 0, NULL);
+#else
+                  pthread_create(&threads[t], NULL, rangeJobThread, &ranges[t]);
+#endif
+                }
+              rows[path].firstReady = 1.0e30;
+              for (t=0;t<nJobs;t++)
+                {
+#ifdef _WIN32
+                  WaitForSingleObject(threads[t], INFINITE);
+                  CloseHandle(threads[t]);
+#else
+                  pthread_join(threads[t], NULL);
+#endif
+                  rows[path].failed += jobs[t].failed;
+                  if (ranges[t].begin < ranges[t].end &&
+                      jobs[t].firstReady < rows[path].firstReady)
+                    rows[path].firstReady = jobs[t].firstReady;
+                }
+              rows[path].lastReady = wesGetTime() - start;
+            }
+          for (t=0;t<nJobs;t++)
+            destroySharedContext(&jobs[t].context);
+        }
 
-    shader = glCreateShader(type);
-    glShaderSource(shader, 1, (const GLchar**)&source, &length);
-    free(source);
-    glCompileShader(shader);
+      if (rows[path].supported)
+        for (k=0;k<n;k++)
+          glDeleteProgram(programs[k]);
+      for (k=0;k<n;k++)
+        {
+          free(vs[k]);
+          free(fs[k]);
+        }
+      if (rows[path].failed > 0)
+        fprintf(stderr, "Error: %d of the %s variants failed to link\n",
+                rows[path].failed, pathNames[path]);
+    }
 
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_ok);
-    if (!shader_ok) {
-        fprintf(stderr, "Failed to compile %s:\n", filename);
-        //show_info_log(shader, glGetShaderiv, glGetShaderInfoLog);
-        glDeleteShader(shader);
-        return 0;
+  printf("--------------------------------------------------\n");
+  printf("Shader compile:\t%d variants of hello-gl.v.glsl + hello-gl.f.glsl, %d threads\n",
+         n, nThreads);
+  printf("  %-28s  programs/sec  first ready ms  last ready ms\n", "path");
+  for (path=0;path<3;path++)
+    {
+      if (!rows[path].supported)
+        {
+          printf("  %-28s  unsupported\n", pathNames[path]);
+          continue;
+        }
+      printf("  %-28s  %12.1f  %14.3f  %13.3f\n", pathNames[path],
+             n/rows[path].lastReady, 1000.0*rows[path].firstReady,
+             1000.0*rows[path].lastReady);
+      fprintf(stderr," WesBench: compile %s: %.1f programs/sec, last of %d ready after %.3f ms\n",
+              pathNames[path], n/rows[path].lastReady, n, 1000.0*rows[path].lastReady);
     }
-    return shader;
+
+  free(vsFile);
+  free(fsFile);
+  free(programs);
+  free(vs);
+  free(fs);
+  free(ready);
 }
 
+/*
+ * -uniformbench N: N small quads a frame, each with its own constants
+ * (position, size, a fade factor on update_fade_factor's curve and a
+ * tint) rewritten by the CPU every frame, the way hello-gl's render()
+ * sets fade_factor. The paths differ only in how the constants reach
+ * the vertex shader: glUniform4fv calls between draws, one uniform
+ * block rewritten by glBufferSubData before each draw, a persistently
+ * mapped ring of blocks selected by glBindBufferRange, and one SSBO of
+ * all the objects read by gl_InstanceID in a single instanced draw.
+ */
+typedef enum
+{
+  UNIFORMS_CALLS = 0,
+  UNIFORMS_SUBDATA,
+  UNIFORMS_RING,
+  UNIFORMS_SSBO
+} UniformPath;
 
+static const char *uniformPathNames[] =
+  { "glUniform", "UBO glBufferSubData", "UBO persistent ring", "SSBO gl_InstanceID" };
 
-int
-main(int argc, char **argv)
+/* std140 and std430 lay this out the same */
+typedef struct
 {
-  myAppState.appName = strdup(argv[0]);
+  GLfloat transform[4];       /* x, y, half size, fade */
+  GLfloat tint[4];
+} ObjectConstants;
 
-  myAppState.triangleAreaInPixels=DEFAULT_TRIANGLE_AREA;
-  myAppState.triangleType = DEFAULT_TRIANGLE_TYPE;
-  myAppState.testDurationSeconds=DEFAULT_TEST_DURATION_SECONDS;
-  myAppState.nFramesLimit=20;
-  myAppState.limitByFrames=0;
-  myAppState.imgWidth = DEFAULT_WIN_WIDTH;
-  myAppState.imgHeight = DEFAULT_WIN_HEIGHT;
-  myAppState.triangleLimit = DEFAULT_TRIANGLE_LIMIT;
-  myAppState.vertexBufLimit = DEFAULT_VERTEXBUF_LIMIT;
-  myAppState.outlineMode = DEFAULT_OUTLINE_MODE_BOOL;
-  myAppState.useFragShader = 0;
-  myAppState.useVertShader = 0;
+typedef struct
+{
+  UniformPath path;
+  int nObjects;
+  FrameRing ring;             /* fenced whenever the constants are persistently mapped */
+  GLuint program, vao, vbo, buffer;
+  GLint transformLoc, tintLoc;
+  ObjectConstants *objects;   /* the CPU copy the glUniform and subdata paths send */
+  unsigned char *persistent;  /* the mapped ring of the ring and SSBO paths */
+  size_t stride, regionBytes; /* one object's slot, one frame's slots */
+  double submitSeconds;
+} UniformBench;
+
+static int
+uniformPathSupported(UniformPath path)
+{
+  int persistent = (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) &&
+    (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+
+  /* the shaders are GLSL 1.40, or 4.30 for the SSBO */
+  if (path == UNIFORMS_SSBO)
+    return GLEW_VERSION_4_3 && persistent;
+  if (path == UNIFORMS_RING)
+    return GLEW_VERSION_3_1 && persistent;
+  return GLEW_VERSION_3_1;
+}
 
-  glfwSetErrorCallback(error_callback);
+/* a grid of quads covering the window, so the fill cost doesn't grow with N */
+static void
+writeObjectConstants(unsigned char *dst, size_t stride, int n, int frame)
+{
+  int side = (int)ceil(sqrt((double)n)), k;
+  float cell = 2.0F/side, t = frame*0.016F;
 
-  if (!glfwInit())
-    exit(EXIT_FAILURE);
+  for (k=0;k<n;k++)
+    {
+      ObjectConstants *o = (ObjectConstants *)(dst + (size_t)k*stride);
+
+      o->transform[0] = -1.0F + cell*((k % side) + 0.5F);
+      o->transform[1] = -1.0F + cell*((k / side) + 0.5F);
+      o->transform[2] = 0.25F*cell;
+      o->transform[3] = sinf(t + 0.001F*k)*0.5F + 0.5F;
+      o->tint[0] = (GLfloat)(k % 3 == 1);
+      o->tint[1] = (GLfloat)(k % 3 == 0);
+      o->tint[2] = (GLfloat)(k % 3 == 2);
+      o->tint[3] = 0.5F;
+    }
+}
 
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+static GLuint
+makeUniformBenchProgram(UniformPath path)
+{
+  static const char *attribNames[] = { "position", NULL };
+  int version = path == UNIFORMS_SSBO ? 430 : 140;
+  GLchar vs[2048], fs[512];
+  size_t n = 0, m = 0;
+  GLuint program;
+
+  shaderAppend(vs, sizeof(vs), &n, "#version %d\nin vec2 position;\nout vec4 color;\n", version);
+  if (path == UNIFORMS_CALLS)
+    shaderAppend(vs, sizeof(vs), &n, "uniform vec4 transform;\nuniform vec4 tint;\n");
+  else if (path == UNIFORMS_SSBO)
+    shaderAppend(vs, sizeof(vs), &n,
+                 "struct ObjectConstants { vec4 transform; vec4 tint; };\n"
+                 "layout(std430, binding = %d) readonly buffer Objects { ObjectConstants objects[]; };\n",
+                 OBJECT_CONSTANTS_BINDING);
+  else
+    shaderAppend(vs, sizeof(vs), &n,
+                 "layout(std140) uniform Object { vec4 transform; vec4 tint; };\n");
+  shaderAppend(vs, sizeof(vs), &n, "void main()\n{\n");
+  if (path == UNIFORMS_SSBO)
+    shaderAppend(vs, sizeof(vs), &n,
+                 "  vec4 transform = objects[gl_InstanceID].transform;\n"
+                 "  vec4 tint = objects[gl_InstanceID].tint;\n");
+  shaderAppend(vs, sizeof(vs), &n,
+               "  gl_Position = vec4(position*transform.z + transform.xy, 0.0, 1.0);\n"
+               "  color = vec4(tint.rgb*transform.w, tint.a);\n"
+               "}\n");
+  shaderAppend(fs, sizeof(fs), &m,
+               "#version %d\nin vec4 color;\nout vec4 fragColor;\n"
+               "void main()\n{\n  fragColor = color;\n}\n", version);
+
+  program = make_program_source(vs, fs, attribNames, uniformPathNames[path]);
+  if (program == 0)
+    {
+      fprintf(stderr, "Error: unable to build the %s program\n", uniformPathNames[path]);
+      exit(1);
+    }
+  if (path == UNIFORMS_SUBDATA || path == UNIFORMS_RING)
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Object"),
+                          OBJECT_CONSTANTS_BINDING);
+  return program;
+}
 
-  parseArgs(argc, argv, &myAppState);
+static void
+setupUniformBench(UniformBench *ub, UniformPath path, const AppState *as)
+{
+  static const GLfloat quad[] = { -1.0F, -1.0F, 1.0F, -1.0F, -1.0F, 1.0F, 1.0F, 1.0F };
+
+  memset(ub, 0, sizeof(*ub));
+  ub->path = path;
+  ub->nObjects = as->uniformObjects;
+  frameRingInit(&ub->ring, 1, 0);
+  ub->program = makeUniformBenchProgram(path);
+  glUseProgram(ub->program);
+
+  glGenVertexArrays(1, &ub->vao);
+  glBindVertexArray(ub->vao);
+  glGenBuffers(1, &ub->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, ub->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+  glEnableVertexAttribArray(0);
+
+  if (path == UNIFORMS_CALLS || path == UNIFORMS_SUBDATA)
+    {
+      ub->objects = (ObjectConstants *)malloc(sizeof(ObjectConstants)*(size_t)ub->nObjects);
+      if (ub->objects == NULL)
+        {
+          fprintf(stderr, "Error: out of memory for %d objects\n", ub->nObjects);
+          exit(1);
+        }
+    }
 
-  GLFWwindow* window = glfwCreateWindow(DEFAULT_WIN_WIDTH, DEFAULT_WIN_HEIGHT, argv[0], NULL, NULL);
-  if (!window)
+  if (path == UNIFORMS_CALLS)
+    {
+      ub->transformLoc = glGetUniformLocation(ub->program, "transform");
+      ub->tintLoc = glGetUniformLocation(ub->program, "tint");
+    }
+  else if (path == UNIFORMS_SUBDATA)
     {
-      glfwTerminate();
-      exit(EXIT_FAILURE);
+      glGenBuffers(1, &ub->buffer);
+      glBindBuffer(GL_UNIFORM_BUFFER, ub->buffer);
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(ObjectConstants), NULL, GL_DYNAMIC_DRAW);
+      glBindBufferBase(GL_UNIFORM_BUFFER, OBJECT_CONSTANTS_BINDING, ub->buffer);
+    }
+  else
+    {
+      GLenum target = path == UNIFORMS_RING ? GL_UNIFORM_BUFFER : GL_SHADER_STORAGE_BUFFER;
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      GLint align = 0;
+
+      glGetIntegerv(path == UNIFORMS_RING ? GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT :
+                    GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+      if (align < 1)
+        align = 1;
+      /* every glBindBufferRange offset has to land on the alignment */
+      ub->stride = path == UNIFORMS_RING ?
+        roundUpBytes(sizeof(ObjectConstants), align) : sizeof(ObjectConstants);
+      ub->regionBytes = roundUpBytes(ub->stride*ub->nObjects, align);
+      frameRingInit(&ub->ring, as->uploadFramesInFlight, 1);
+
+      glGenBuffers(1, &ub->buffer);
+      glBindBuffer(target, ub->buffer);
+      glBufferStorage(target, ub->regionBytes*ub->ring.nRegions, NULL, flags);
+      ub->persistent = (unsigned char *)glMapBufferRange(target, 0,
+                                                         ub->regionBytes*ub->ring.nRegions, flags);
+      if (ub->persistent == NULL)
+        {
+          fprintf(stderr, "Error: couldn't map a %.1f MB constant ring\n",
+                  ub->regionBytes*ub->ring.nRegions/(1024.0*1024.0));
+          exit(1);
+        }
     }
+}
+
+static void
+uniformBenchFrame(UniformBench *ub)
+{
+  double t0 = wesGetTime();
+  /* the rings must not overwrite constants the GPU still reads */
+  int region = frameRingBegin(&ub->ring), k;
+  size_t base = (size_t)region*ub->regionBytes;
+
+  glClear(GL_COLOR_BUFFER_BIT);
+  switch (ub->path)
+    {
+    case UNIFORMS_CALLS:
+      writeObjectConstants((unsigned char *)ub->objects, sizeof(ObjectConstants),
+                           ub->nObjects, ub->ring.frame);
+      for (k=0;k<ub->nObjects;k++)
+        {
+          glUniform4fv(ub->transformLoc, 1, ub->objects[k].transform);
+          glUniform4fv(ub->tintLoc, 1, ub->objects[k].tint);
+          glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+      break;
 
-  glfwSetKeyCallback(window, key_callback);
+    case UNIFORMS_SUBDATA:
+      writeObjectConstants((unsigned char *)ub->objects, sizeof(ObjectConstants),
+                           ub->nObjects, ub->ring.frame);
+      for (k=0;k<ub->nObjects;k++)
+        {
+          glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ObjectConstants), &ub->objects[k]);
+          glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+      break;
 
-  glfwMakeContextCurrent(window);
-  // start GLEW extension handler
-  // glewExperimental = GL_TRUE;
-  glewInit();
-  glfwSwapInterval(1);
+    case UNIFORMS_RING:
+      writeObjectConstants(ub->persistent + base, ub->stride, ub->nObjects, ub->ring.frame);
+      for (k=0;k<ub->nObjects;k++)
+        {
+          glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_CONSTANTS_BINDING, ub->buffer,
+                            base + (size_t)k*ub->stride, sizeof(ObjectConstants));
+          glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+      break;
 
-  printInfo(window);
+    case UNIFORMS_SSBO:
+      writeObjectConstants(ub->persistent + base, ub->stride, ub->nObjects, ub->ring.frame);
+      glBindBufferRange(GL_SHADER_STORAGE_BUFFER, OBJECT_CONSTANTS_BINDING, ub->buffer,
+                        base, ub->stride*ub->nObjects);
+      glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, ub->nObjects);
+      break;
+    }
 
-  GLuint program = glCreateProgram();
-  if (myAppState.useFragShader == 1) {
-      printf("using frag shader\n");
-      GLuint fragmentshader = make_shader(GL_FRAGMENT_SHADER, "hello-gl.f.glsl");
-      glAttachShader(program, fragmentshader);
-  } 
-
-  if (myAppState.useVertShader == 1) {
-      printf("using vert shader\n");
-      GLuint vertexshader = make_shader(GL_VERTEX_SHADER, "hello-gl.v.glsl");
-      glAttachShader(program, vertexshader);
-  }
+  frameRingEnd(&ub->ring);
+  ub->submitSeconds += wesGetTime() - t0;
+}
 
-  glLinkProgram(program);
+static void
+destroyUniformBench(UniformBench *ub)
+{
+  GLenum target = ub->path == UNIFORMS_SSBO ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
 
-  Init();
-  while (!glfwWindowShouldClose(window))
+  frameRingDestroy(&ub->ring);
+  if (ub->buffer != 0)
     {
-      glUseProgram(program);
-      runBenchmark();
-      glfwSwapBuffers(window);
-      glfwPollEvents();
+      glBindBuffer(target, ub->buffer);
+      if (ub->persistent != NULL)
+        glUnmapBuffer(target);
+      glBindBuffer(target, 0);
+      glDeleteBuffers(1, &ub->buffer);
     }
-  return 0;
+  glBindVertexArray(0);
+  glDeleteVertexArrays(1, &ub->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &ub->vbo);
+  glUseProgram(0);
+  glDeleteProgram(ub->program);
+  free(ub->objects);
 }
 
-void printInfo (GLFWwindow * window) {
+static void
+runUniformBenchmark(AppState *as)
+{
+  int path;
+  struct
+  {
+    int supported, frames;
+    double seconds, submitSeconds;
+  } rows[UNIFORMS_SSBO+1];
 
-  /* Display the gfx card information */
-  printf( "--------------------------------------------------\n");
-  printf ("Vendor:      %s\n", glGetString(GL_VENDOR));
-  printf ("Renderer:    %s\n", glGetString(GL_RENDERER));
-  printf ("Version:     %s\n", glGetString(GL_VERSION));
-  GLFWmonitor * monitor = glfwGetPrimaryMonitor();
-  const GLFWvidmode * vidMode = glfwGetVideoMode(monitor);
-  printf( "Visual:      RGBA=<%d,%d,%d,%d>  Z=<%d>  double=%d\n",
-          vidMode->redBits,
-          vidMode->blueBits,
-          vidMode->greenBits,
-          GLFW_ALPHA_BITS,
-          GLFW_DEPTH_BITS,
-          1 );
-  int winWidth, winHeight;
-  glfwGetFramebufferSize(window, &winWidth, &winHeight);
-  int xPos, yPos;
-  glfwGetWindowPos(window, &xPos, &yPos);
-  printf( "Geometry:    %dx%d+%d+%d\n",
-          winWidth,
-          winHeight,
-          xPos,
-          yPos);
-  printf( "Screen:      %dx%d\n",
-          vidMode->width,
-          vidMode->height);
-  printf( "--------------------------------------------------\n");
+  glViewport(0, 0, as->imgWidth, as->imgHeight);
+  for (path=UNIFORMS_CALLS;path<=UNIFORMS_SSBO;path++)
+    {
+      UniformBench ub;
+      double start;
+
+      memset(&rows[path], 0, sizeof(rows[path]));
+      rows[path].supported = uniformPathSupported((UniformPath)path);
+      if (!rows[path].supported)
+        continue;
+      setupUniformBench(&ub, (UniformPath)path, as);
+
+      /* the first frame pays for the driver's deferred program setup */
+      uniformBenchFrame(&ub);
+      glFinish();
+      ub.submitSeconds = 0.0;
+
+      start = wesGetTime();
+      do
+        {
+          uniformBenchFrame(&ub);
+          rows[path].frames++;
+        }
+      while (wesGetTime() - start < as->testDurationSeconds);
+      glFinish();
+      rows[path].seconds = wesGetTime() - start;
+      rows[path].submitSeconds = ub.submitSeconds;
+      destroyUniformBench(&ub);
+    }
 
+  printf("--------------------------------------------------\n");
+  printf("Uniforms:\t%d objects a frame, %d frames in flight for the rings\n",
+         as->uniformObjects, as->uploadFramesInFlight);
+  printf("  %-20s  Mobjects/sec  draws/frame  ms/frame  submit ms/frame\n", "path");
+  for (path=UNIFORMS_CALLS;path<=UNIFORMS_SSBO;path++)
+    {
+      double objects = (double)as->uniformObjects*rows[path].frames;
 
-  /* print out the test parameters */
+      if (!rows[path].supported)
+        {
+          printf("  %-20s  unsupported\n", uniformPathNames[path]);
+          continue;
+        }
+      printf("  %-20s  %12.3f  %11d  %8.3f  %15.3f\n", uniformPathNames[path],
+             objects/rows[path].seconds*1.0e-6,
+             path == UNIFORMS_SSBO ? 1 : as->uniformObjects,
+             1000.0*rows[path].seconds/rows[path].frames,
+             1000.0*rows[path].submitSeconds/rows[path].frames);
+      fprintf(stderr," WesBench: uniforms %s: %.3f Mobjects/sec\n",
+              uniformPathNames[path], objects/rows[path].seconds*1.0e-6);
+    }
+}
 
-  printf("Triangle area\t%4.3f (pixels^2)\n", myAppState.triangleAreaInPixels);
-  printf("Test duration\t%f(s)\n", myAppState.testDurationSeconds);
-  printf("Screen W/H\t(%d,%d)\n", myAppState.imgWidth, myAppState.imgHeight);
-  printf("Triangle limit\t%ld\n", myAppState.triangleLimit);
-  printf("VertexBuf limit\t%ld\n", myAppState.vertexBufLimit);
-  printf("Triangle type\t%d \n", myAppState.triangleType);
+/*
+ * -upload all: the same mesh through every upload strategy in turn,
+ * then one table comparing them.
+ */
+static void
+runUploadMatrix(AppState *as)
+{
+  int m, k;
+  struct
+  {
+    int supported;
+    double gbps, stallMs, mtris;
+  } rows[UPLOAD_PERSISTENT+1];
+
+  for (m=UPLOAD_ORPHAN;m<=UPLOAD_PERSISTENT;m++)
+    {
+      rows[m].supported = uploadModeSupported((UploadMode)m);
+      if (!rows[m].supported)
+        continue;
+      as->uploadMode = (UploadMode)m;
+      wesTriangleRateBenchmark(as);
+      reportResults(as);
+      rows[m].gbps = as->computedUploadGBPerSecond;
+      rows[m].stallMs = as->computedUploadStallMsPerFrame;
+      rows[m].mtris = as->computedMTrisPerSecond;
+    }
 
+  printf("--------------------------------------------------\n");
+  printf("  %-20s  upload GB/sec  stall ms/frame   Mtri/sec\n", "strategy");
+  for (k=UPLOAD_ORPHAN;k<=UPLOAD_PERSISTENT;k++)
+    {
+      if (!rows[k].supported)
+        {
+          printf("  %-20s  unsupported\n", uploadModeNames[k]);
+          continue;
+        }
+      printf("  %-20s  %13.3f  %14.3f  %9.3f\n", uploadModeNames[k],
+             rows[k].gbps, rows[k].stallMs, rows[k].mtris);
+    }
 }
 
 void runBenchmark(void) {
 
-     if (0) { // run area test here
-			int powCounter = 1;
-			while (powCounter <= 17) { // 2^17 = 131K
-				myAppState.triangleAreaInPixels = pow(2, powCounter);
-				wesTriangleRateBenchmark(&myAppState);
-				
-      				fprintf(stderr," WesBench: area=%2.1f px, tri rate = %3.2f Mtri/sec, vertex rate=%3.2f Mverts/sec, fill rate = %4.2f Mpix/sec, verts/bucket=%zu, indices/bucket=%zu\n", myAppState.triangleAreaInPixels, myAppState.computedMTrisPerSecond, myAppState.computedMVertexOpsPerSecond, myAppState.computedMFragsPerSecond, myAppState.computedVertsPerArrayCall, myAppState.computedIndicesPerArrayCall);
-
-				powCounter++;
-			}
-
+     if (myAppState.sweepMode) {
+      		runAreaSweep(&myAppState);
+     } else if (myAppState.formatMatrix) {
+      		runFormatMatrix(&myAppState);
+     } else if (myAppState.fetchSweep) {
+      		runFetchSweep(&myAppState);
+     } else if (myAppState.vertCurve) {
+      		runVertexCurve(&myAppState);
+     } else if (myAppState.divergeMatrix) {
+      		runDivergenceMatrix(&myAppState);
+     } else if (myAppState.compileVariants > 0) {
+      		runCompileBenchmark(&myAppState);
+     } else if (myAppState.uniformObjects > 0) {
+      		runUniformBenchmark(&myAppState);
+     } else if (myAppState.texAccessMatrix) {
+      		runTextureAccessMatrix(&myAppState);
+     } else if (myAppState.uploadMatrix) {
+      		runUploadMatrix(&myAppState);
      } else {
-      		wesTriangleRateBenchmark(&myAppState);
+      		int trial;
 
-      		fprintf(stderr," WesBench: area=%2.1f px, tri rate = %3.2f Mtri/sec, vertex rate=%3.2f Mverts/sec, fill rate = %4.2f Mpix/sec, verts/bucket=%zu, indices/bucket=%zu\n", myAppState.triangleAreaInPixels, myAppState.computedMTrisPerSecond, myAppState.computedMVertexOpsPerSecond, myAppState.computedMFragsPerSecond, myAppState.computedVertsPerArrayCall, myAppState.computedIndicesPerArrayCall);
+      		/* later trials reuse the cached mesh */
+      		for (trial=0;trial<myAppState.nTrials;trial++) {
+      			wesTriangleRateBenchmark(&myAppState);
+
+      			reportResults(&myAppState);
+      		}
      } 
 
-  glfwTerminate();
+  meshCacheTrim(0);
+  arenaPoolRelease();
+  print_shader_stats();
+
+#if WESBENCH_HEADLESS
+  if (myAppState.headless != 0)
+    shutdownHeadless(&myAppState);
+  else
+#endif
+    glfwTerminate();
   exit(0);
 }
 /* EOF */